@@ -0,0 +1,42 @@
+#include "arena.h"
+#include <algorithm>
+
+Arena::Arena(size_t blockSize) : m_blockSize(blockSize),
+	m_current(nullptr),
+	m_left(0),
+	m_bytesAllocated(0)
+{
+}
+
+const char* Arena::copy(const std::string& str)
+{
+	return copy(str.c_str(), str.size() + 1);
+}
+
+void Arena::clear()
+{
+	m_blocks.clear();
+	m_current = nullptr;
+	m_left = 0;
+	m_bytesAllocated = 0;
+}
+
+void* Arena::allocateRaw(size_t size, size_t alignment)
+{
+	size_t padding = (alignment - (size_t)m_current % alignment) % alignment;
+	if(!m_current || (padding + size > m_left))
+	{
+		// Oversized arrays get a block of their own, new[] alignment is
+		// enough for any type stored here
+		size_t blockSize = std::max(m_blockSize, size);
+		m_blocks.emplace_back(new char[blockSize]);
+		m_current = m_blocks.back().get();
+		m_left = blockSize;
+		padding = 0;
+	}
+	void* result = m_current + padding;
+	m_current += padding + size;
+	m_left -= padding + size;
+	m_bytesAllocated += size;
+	return result;
+}
@@ -0,0 +1,60 @@
+
+#ifndef ARENA_H_T6JD4WQP
+#define ARENA_H_T6JD4WQP
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Bump allocator for many small arrays living as long as the arena. Memory
+ * is carved from large blocks and released all at once by clear() or the
+ * destructor, so only trivially destructible types can be stored.
+ */
+class Arena
+{
+public:
+	static const size_t DefaultBlockSize = 1 << 20;
+
+	explicit Arena(size_t blockSize = DefaultBlockSize);
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	template <typename T>
+	T* allocate(size_t count)
+	{
+		static_assert(std::is_trivially_destructible<T>::value, "Arena doesn't run destructors");
+		return static_cast<T*>(allocateRaw(count * sizeof(T), alignof(T)));
+	}
+
+	template <typename T>
+	T* copy(const T* data, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only POD values can be copied to arena");
+		T* result = allocate<T>(count);
+		if(count > 0)
+			memcpy(result, data, count * sizeof(T));
+		return result;
+	}
+
+	// Null-terminated copy of str
+	const char* copy(const std::string& str);
+
+	void clear();
+	size_t bytesAllocated() const { return m_bytesAllocated; }
+
+private:
+	void* allocateRaw(size_t size, size_t alignment);
+
+private:
+	size_t m_blockSize;
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+	char* m_current;
+	size_t m_left;
+	size_t m_bytesAllocated;
+};
+
+#endif /* end of include guard: ARENA_H_T6JD4WQP */
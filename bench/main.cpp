@@ -0,0 +1,268 @@
+
+/*
+ * Benchmarks of mining kernels and of whole miners on synthetic quotes.
+ *
+ * Usage: pattern-mining-bench [filter]
+ *
+ * Only benchmarks whose name contains filter are run.
+ */
+
+#include "log.h"
+#include "model/quotes.h"
+#include "model/syntheticquotes.h"
+#include "miners/candleminer.h"
+#include "miners/minmaxminer.h"
+#include "miners/patternstore.h"
+#include "miners/ttminer.h"
+#include "json/value.h"
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const double MinBenchSeconds = 0.5;
+static const size_t MacroSizes[] = { 1000, 2000, 4000 };
+static const int MacroTickers = 2;
+
+static std::string g_filter;
+static volatile size_t g_sink;
+
+static bool selected(const std::string& name)
+{
+	return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+static double elapsed(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/*
+ * Calls op with increasing iteration indices until MinBenchSeconds pass and
+ * prints average time per call
+ */
+static void runMicro(const std::string& name, const std::function<size_t(size_t)>& op)
+{
+	if(!selected(name))
+		return;
+
+	size_t iterations = 0;
+	size_t batch = 1;
+	double seconds = 0;
+	auto start = Clock::now();
+	while(seconds < MinBenchSeconds)
+	{
+		for(size_t i = 0; i < batch; i++)
+			g_sink += op(iterations + i);
+		iterations += batch;
+		batch *= 2;
+		seconds = elapsed(start);
+	}
+	printf("%-40s %12zu iter %12.1f ns/op\n", name.c_str(), iterations, seconds * 1e9 / iterations);
+	fflush(stdout);
+}
+
+static std::vector<Quotes::Ptr> makeQuotes(int tickers, size_t bars)
+{
+	std::vector<Quotes::Ptr> result;
+	for(int i = 0; i < tickers; i++)
+	{
+		SyntheticParams params;
+		params.ticker = "SYN" + std::to_string(i);
+		params.bars = bars;
+		params.seed = i + 1;
+		result.push_back(generateQuotes(params));
+	}
+	return result;
+}
+
+static void reportMacro(const std::string& name, size_t windows, uint64_t comparisons, double seconds)
+{
+	printf("%-40s %10.3f s %14.0f windows/s", name.c_str(), seconds, windows / seconds);
+	if(comparisons > 0)
+		printf(" %14.0f comparisons/s", comparisons / seconds);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void benchFit()
+{
+	auto quotes = makeQuotes(1, 10000);
+	for(int length : { 2, 3, 5 })
+	{
+		Json::Value config;
+		config["pattern-length"] = length;
+		CandleMiner miner;
+		miner.parseConfig(config);
+		PatternStore store(quotes, length);
+		size_t n = store.size();
+		runMicro("fit/length=" + std::to_string(length), [&](size_t i) {
+				return (size_t)miner.fit(store[i % n], store[(i * 7919) % n], length);
+			});
+	}
+}
+
+static void benchSignature()
+{
+	auto quotes = makeQuotes(1, 10000);
+	const auto& q = quotes.front();
+	for(int length : { 2, 5 })
+	{
+		size_t n = q->length() - length;
+		runMicro("calculateSignature/length=" + std::to_string(length), [&](size_t i) {
+				return calculateSignature(q, i % n, length).size();
+			});
+	}
+}
+
+static void benchZigzags()
+{
+	auto quotes = makeQuotes(1, 10000);
+	const auto& q = quotes.front();
+	size_t n = q->length() - 1;
+	for(int zigzags : { 2, 4 })
+	{
+		runMicro("findZigzags/zigzags=" + std::to_string(zigzags), [&](size_t i) {
+				return findZigzags(q, i % n, 6, zigzags).size();
+			});
+	}
+}
+
+static void benchLoadCsv()
+{
+	if(!selected("loadFromCsv"))
+		return;
+
+	auto quotes = makeQuotes(1, 100000);
+	auto filename = (boost::filesystem::temp_directory_path() /
+			boost::filesystem::unique_path("pattern-mining-bench-%%%%%%.csv")).string();
+	quotes.front()->saveToCsv(filename);
+	auto start = Clock::now();
+	int runs = 0;
+	while(elapsed(start) < MinBenchSeconds)
+	{
+		Quotes q;
+		q.loadFromCsv(filename);
+		g_sink += q.length();
+		runs++;
+	}
+	double seconds = elapsed(start);
+	boost::filesystem::remove(filename);
+	printf("%-40s %12d iter %12.0f candles/s\n", "loadFromCsv/bars=100000", runs,
+			quotes.front()->length() * runs / seconds);
+	fflush(stdout);
+}
+
+static void benchCandleMiner()
+{
+	for(size_t bars : MacroSizes)
+	{
+		auto name = "CandleMiner/bars=" + std::to_string(bars);
+		if(!selected(name))
+			continue;
+		auto quotes = makeQuotes(MacroTickers, bars);
+		Json::Value config;
+		config["pattern-length"] = 3;
+		config["exit-after"] = 3;
+		config["candle-fit-tolerance"] = 0.1;
+		CandleMiner miner;
+		miner.parseConfig(config);
+		auto start = Clock::now();
+		miner.setQuotes(quotes);
+		miner.mine();
+		reportMacro(name, MacroTickers * bars, miner.comparisons(), elapsed(start));
+	}
+}
+
+/*
+ * Same runs as benchCandleMiner() from column files, with a budget small
+ * enough to split windows into several blocks
+ */
+static void benchCandleMinerOutOfCore()
+{
+	for(size_t bars : MacroSizes)
+	{
+		auto name = "CandleMiner/out-of-core/bars=" + std::to_string(bars);
+		if(!selected(name))
+			continue;
+		auto quotes = makeQuotes(MacroTickers, bars);
+		auto directory = boost::filesystem::temp_directory_path() /
+			boost::filesystem::unique_path("pattern-mining-bench-%%%%%%");
+		Json::Value config;
+		config["pattern-length"] = 3;
+		config["exit-after"] = 3;
+		config["candle-fit-tolerance"] = 0.1;
+		config["out-of-core"]["directory"] = directory.string();
+		config["out-of-core"]["memory-budget"] = 0.25;
+		CandleMiner miner;
+		miner.parseConfig(config);
+		auto start = Clock::now();
+		for(const auto& q : quotes)
+			miner.spill(q);
+		miner.mine();
+		reportMacro(name, MacroTickers * bars, miner.comparisons(), elapsed(start));
+		boost::filesystem::remove_all(directory);
+	}
+}
+
+static void benchMinmaxMiner()
+{
+	for(size_t bars : MacroSizes)
+	{
+		auto name = "MinmaxMiner/bars=" + std::to_string(bars);
+		if(!selected(name))
+			continue;
+		auto quotes = makeQuotes(MacroTickers, bars);
+		Json::Value config;
+		config["zigzags"] = 3;
+		config["epsilon"] = 6;
+		config["exit-after"] = 3;
+		MinmaxMiner miner;
+		miner.parseConfig(config);
+		auto start = Clock::now();
+		miner.setQuotes(quotes);
+		miner.mine();
+		reportMacro(name, MacroTickers * bars, miner.comparisons(), elapsed(start));
+	}
+}
+
+static void benchTtMiner()
+{
+	for(size_t bars : MacroSizes)
+	{
+		auto name = "TtMiner/bars=" + std::to_string(bars * 100);
+		if(!selected(name))
+			continue;
+		auto quotes = makeQuotes(1, bars * 100);
+		Json::Value config;
+		config["exit-after"] = 3;
+		TtMiner miner(TtMiner::parseParams(config));
+		auto start = Clock::now();
+		g_sink += miner.mine(*quotes.front()).size();
+		reportMacro(name, bars * 100, 0, elapsed(start));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc > 1)
+		g_filter = argv[1];
+
+	initLogging("pattern-mining-bench.log", false);
+
+	benchFit();
+	benchSignature();
+	benchZigzags();
+	benchLoadCsv();
+
+	benchCandleMiner();
+	benchCandleMinerOutOfCore();
+	benchMinmaxMiner();
+	benchTtMiner();
+
+	return 0;
+}
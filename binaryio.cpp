@@ -0,0 +1,129 @@
+
+#include "binaryio.h"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <stdexcept>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Flushes file (or directory on POSIX) contents to disk
+ */
+static bool syncPath(const std::string& path, bool directory)
+{
+#ifdef WIN32
+	if(directory)
+		return true; // MoveFileEx with MOVEFILE_WRITE_THROUGH flushes the rename
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+	bool result = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return result;
+#else
+	int fd = open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+	if(fd < 0)
+		return false;
+	bool result = fsync(fd) == 0;
+	close(fd);
+	return result;
+#endif
+}
+
+BinaryWriter::BinaryWriter(const std::string& filename) : m_filename(filename),
+	m_tempFilename(filename + ".tmp"),
+	m_committed(false)
+{
+	m_out.open(m_tempFilename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+	if(!m_out.good())
+		throw std::runtime_error("Unable to open file: " + m_tempFilename);
+}
+
+BinaryWriter::~BinaryWriter()
+{
+	if(!m_committed)
+	{
+		m_out.close();
+		std::remove(m_tempFilename.c_str());
+	}
+}
+
+void BinaryWriter::writeString(const std::string& str)
+{
+	write<uint64_t>(str.size());
+	writeRaw(str.data(), str.size());
+}
+
+void BinaryWriter::writeRaw(const void* data, size_t size)
+{
+	m_out.write(static_cast<const char*>(data), size);
+	if(!m_out.good())
+		throw std::runtime_error("Unable to write file: " + m_tempFilename);
+}
+
+void BinaryWriter::commit()
+{
+	m_out.close();
+	if(m_out.fail())
+		throw std::runtime_error("Unable to write file: " + m_tempFilename);
+	// Contents reach the disk before the rename, and the rename before
+	// commit() returns, so that a crash leaves either file complete
+	if(!syncPath(m_tempFilename, false))
+		throw std::runtime_error("Unable to sync file: " + m_tempFilename);
+#ifdef WIN32
+	if(!MoveFileExA(m_tempFilename.c_str(), m_filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		throw std::runtime_error("Unable to replace file: " + m_filename);
+#else
+	if(std::rename(m_tempFilename.c_str(), m_filename.c_str()) != 0)
+		throw std::runtime_error("Unable to replace file: " + m_filename);
+#endif
+	m_committed = true;
+	auto directory = boost::filesystem::path(m_filename).parent_path();
+	if(!syncPath(directory.empty() ? "." : directory.string(), true))
+		throw std::runtime_error("Unable to sync directory of file: " + m_filename);
+}
+
+BinaryReader::BinaryReader(const std::string& filename) : m_filename(filename)
+{
+	m_in.open(filename, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+	if(!m_in.good())
+		throw std::runtime_error("Unable to open file: " + filename);
+	m_length = m_in.tellg();
+	m_in.seekg(0);
+}
+
+BinaryReader::~BinaryReader()
+{
+}
+
+std::string BinaryReader::readString()
+{
+	std::string str(readCount(1), '\0');
+	readRaw(&str[0], str.size());
+	return str;
+}
+
+void BinaryReader::readRaw(void* data, size_t size)
+{
+	m_in.read(static_cast<char*>(data), size);
+	if((size_t)m_in.gcount() != size)
+		throw std::runtime_error("Unexpected end of file: " + m_filename);
+}
+
+size_t BinaryReader::readCount(size_t elementSize)
+{
+	uint64_t size = read<uint64_t>();
+	if(size > (m_length - (size_t)m_in.tellg()) / elementSize)
+		throw std::runtime_error("Corrupt file, record is longer than file: " + m_filename);
+	return size;
+}
+
+bool BinaryReader::atEnd()
+{
+	return m_in.peek() == std::ifstream::traits_type::eof();
+}
@@ -0,0 +1,92 @@
+
+#ifndef BINARYIO_H_Q7ZK2MVA
+#define BINARYIO_H_Q7ZK2MVA
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+/*
+ * Writes plain binary records to a temporary file which replaces the target
+ * only on commit(), so readers never see a partially written file. The file
+ * is synced to disk before the rename, so the target stays complete after
+ * a crash or power loss too.
+ */
+class BinaryWriter
+{
+public:
+	BinaryWriter(const std::string& filename);
+	~BinaryWriter();
+
+	template <typename T>
+	void write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only POD values can be written");
+		writeRaw(&value, sizeof(T));
+	}
+
+	template <typename T>
+	void writeVector(const std::vector<T>& v)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only POD values can be written");
+		write<uint64_t>(v.size());
+		writeRaw(v.data(), v.size() * sizeof(T));
+	}
+
+	void writeString(const std::string& str);
+	void writeRaw(const void* data, size_t size);
+
+	void commit();
+
+private:
+	std::string m_filename;
+	std::string m_tempFilename;
+	std::ofstream m_out;
+	bool m_committed;
+};
+
+class BinaryReader
+{
+public:
+	BinaryReader(const std::string& filename);
+	~BinaryReader();
+
+	template <typename T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only POD values can be read");
+		T value;
+		readRaw(&value, sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	std::vector<T> readVector()
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Only POD values can be read");
+		std::vector<T> v(readCount(sizeof(T)));
+		readRaw(v.data(), v.size() * sizeof(T));
+		return v;
+	}
+
+	std::string readString();
+	void readRaw(void* data, size_t size);
+
+	/*
+	 * Element count of a record whose elements take at least elementSize
+	 * bytes each, checked against the rest of the file so that a corrupt
+	 * count can't cause a huge allocation
+	 */
+	size_t readCount(size_t elementSize);
+
+	bool atEnd();
+
+private:
+	std::string m_filename;
+	std::ifstream m_in;
+	size_t m_length;
+};
+
+#endif /* end of include guard: BINARYIO_H_Q7ZK2MVA */
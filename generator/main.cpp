@@ -0,0 +1,132 @@
+
+/*
+ * Writes reproducible synthetic quotes in finam format for load tests.
+ *
+ * Usage: pattern-mining-generate <config> <output directory>
+ *
+ * Every ticker goes to <output directory>/<ticker>.csv. Positions and
+ * realized forward returns of planted patterns go to planted.csv.
+ *
+ * Config example:
+ * {
+ *   "seed": 1, "tickers": 10, "bars": 100000, "ticker-prefix": "SYN",
+ *   "start-price": 100, "tick-size": 0.01, "start-time": 1420070400, "period": 60,
+ *   "volatility": { "model": "garch", "sigma": 0.002, "alpha": 0.05, "beta": 0.9 },
+ *   "volume": { "mean": 1000, "persistence": 0.9, "sigma": 0.3, "return-sensitivity": 0.5 },
+ *   "session": { "bars": 840, "gap": 36000, "gap-sigma": 0.005 },
+ *   "planted": [ { "candles": [ [1, 1.01, 0.998, 1.008], [1.008, 1.012, 0.995, 0.997] ],
+ *                  "count": 50, "exit-after": 3, "return": 0.01 } ]
+ * }
+ *
+ * Planted candles are [open, high, low, close] relative to the first open.
+ */
+
+#include "model/quotes.h"
+#include "model/syntheticquotes.h"
+#include "json/value.h"
+#include "json/reader.h"
+#include <boost/filesystem.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+static SyntheticParams parseParams(const Json::Value& root)
+{
+	SyntheticParams params;
+	params.bars = root.get("bars", (Json::UInt64)params.bars).asUInt64();
+	params.seed = root.get("seed", (Json::UInt64)params.seed).asUInt64();
+	params.startPrice = root.get("start-price", params.startPrice).asDouble();
+	params.tickSize = root.get("tick-size", params.tickSize).asDouble();
+	params.startTime = root.get("start-time", (Json::Int64)params.startTime).asInt64();
+	params.period = root.get("period", params.period).asInt();
+
+	auto volatility = root["volatility"];
+	auto model = volatility.get("model", "random-walk").asString();
+	if(model == "garch")
+		params.volatilityModel = SyntheticParams::Garch;
+	else if(model == "random-walk")
+		params.volatilityModel = SyntheticParams::RandomWalk;
+	else
+		throw std::runtime_error("Unknown volatility model: " + model);
+	params.volatility = volatility.get("sigma", params.volatility).asDouble();
+	params.garchAlpha = volatility.get("alpha", params.garchAlpha).asDouble();
+	params.garchBeta = volatility.get("beta", params.garchBeta).asDouble();
+
+	auto volume = root["volume"];
+	params.meanVolume = volume.get("mean", params.meanVolume).asDouble();
+	params.volumePersistence = volume.get("persistence", params.volumePersistence).asDouble();
+	params.volumeVolatility = volume.get("sigma", params.volumeVolatility).asDouble();
+	params.volumeReturnSensitivity = volume.get("return-sensitivity", params.volumeReturnSensitivity).asDouble();
+
+	auto session = root["session"];
+	params.sessionBars = session.get("bars", 0).asUInt();
+	params.sessionGap = session.get("gap", 0).asInt();
+	params.gapVolatility = session.get("gap-sigma", 0).asDouble();
+
+	for(const auto& planted : root["planted"])
+	{
+		PlantedPattern p;
+		for(const auto& c : planted["candles"])
+		{
+			if(c.size() != 4)
+				throw std::runtime_error("Planted candle should be [open, high, low, close]");
+			p.candles.emplace_back(c[0].asDouble(), c[1].asDouble(), c[2].asDouble(), c[3].asDouble(), 0, TimePoint(0));
+		}
+		p.count = planted.get("count", 1).asInt();
+		p.exitAfter = planted.get("exit-after", 1).asInt();
+		p.forwardReturn = planted.get("return", 0).asDouble();
+		params.planted.push_back(p);
+	}
+	return params;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "USAGE: pattern-mining-generate <config> <output directory>\n");
+		return 1;
+	}
+
+	std::ifstream configFile(argv[1], std::fstream::binary);
+	if(!configFile.good())
+		throw std::runtime_error("Unable to open config file");
+	Json::Value root;
+	configFile >> root;
+
+	boost::filesystem::path outputDir(argv[2]);
+	boost::filesystem::create_directories(outputDir);
+
+	auto params = parseParams(root);
+	int tickers = root.get("tickers", 1).asInt();
+	auto prefix = root.get("ticker-prefix", "SYN").asString();
+	uint64_t seed = params.seed;
+
+	std::ofstream truth((outputDir / "planted.csv").string());
+	if(!truth.good())
+		throw std::runtime_error("Unable to open file: " + (outputDir / "planted.csv").string());
+	truth << "<TICKER>,<POS>,<TIME>,<PATTERN>,<EXIT-AFTER>,<RETURN>\n";
+	truth.precision(10);
+
+	for(int i = 0; i < tickers; i++)
+	{
+		params.ticker = prefix + std::to_string(i);
+		params.seed = seed + i;
+		std::vector<Plant> plants;
+		auto q = generateQuotes(params, &plants);
+		q->saveToCsv((outputDir / (params.ticker + ".csv")).string());
+
+		for(const auto& plant : plants)
+		{
+			const auto& p = params.planted[plant.pattern];
+			size_t entry = plant.pos + p.candles.size();
+			double ret = (q->at(entry + p.exitAfter - 1).close - q->at(entry).open) / q->at(entry).open;
+			truth << params.ticker << ',' << plant.pos << ',' << q->at(plant.pos).time.sec << ','
+				<< plant.pattern << ',' << p.exitAfter << ',' << ret << '\n';
+		}
+		std::cout << "Generated " << params.ticker << ", " << q->length() << " points, "
+			<< plants.size() << " planted patterns" << std::endl;
+	}
+	return 0;
+}
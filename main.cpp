@@ -5,12 +5,21 @@
 #include "miners/minmaxminer.h"
 #include "optionparser/optionparser.h"
 #include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
 #include "report/textreportbuilder.h"
 #include "report/htmlreportbuilder.h"
 #include "miners/iminer.h"
 #include "json/value.h"
 #include "json/reader.h"
 #include "miners/candleminer.h"
+#include "profiler.h"
+#include "pipeline.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 using namespace boost;
 
@@ -81,6 +90,19 @@ struct Arg: public option::Arg
 		if (msg) printError("Option '", option, "' requires a numeric argument\n");
 		return option::ARG_ILLEGAL;
 	}
+
+	static option::ArgStatus Shard(const option::Option& option, bool msg)
+	{
+		int index = -1;
+		int count = 0;
+		char tail = 0;
+		if (option.arg != 0 && sscanf(option.arg, "%d/%d%c", &index, &count, &tail) == 2 &&
+				(count > 0) && (index >= 0) && (index < count))
+			return option::ARG_OK;
+
+		if (msg) printError("Option '", option, "' requires an argument in form k/n, where 0 <= k < n\n");
+		return option::ARG_ILLEGAL;
+	}
 };
 
 enum MinerType { minerCandle, minerTime, minerZigzag };
@@ -90,10 +112,16 @@ enum  optionIndex { UNKNOWN, HELP, INPUT_FILENAME,
 	MINER_TYPE,
 	OUTPUT_FILENAME,
 	REPORT_TYPE,
-	CONFIG_FILE
+	CONFIG_FILE,
+	CHECKPOINT_FILE,
+	CHECKPOINT_INTERVAL,
+	RESUME,
+	SHARD,
+	PROFILE_OUTPUT
 };
 const option::Descriptor usage[] = {
-{ UNKNOWN, 0,"", "",        Arg::Unknown, "USAGE: patter-miner [options]\n\n"
+{ UNKNOWN, 0,"", "",        Arg::Unknown, "USAGE: patter-miner [options]\n"
+                                          "       patter-miner [options] merge <shard files...>\n\n"
                                           "Options:" },
 { HELP,    0,"", "help",    Arg::None,    "  \t--help  \tPrint usage and exit." },
 { INPUT_FILENAME ,0,"i","input-filename",Arg::Required,"  -i <filename>, \t--input-filename=<filename>  \tPath to quotes in finam format" },
@@ -103,8 +131,18 @@ const option::Descriptor usage[] = {
 { OUTPUT_FILENAME ,0,"","output-filename",Arg::Required,"  --output-filename=<filename>  \tSpecifies filename for generated report." },
 { REPORT_TYPE ,0,"","report-type",Arg::Required,"  --report-type={html,txt}  \tSpecifies report format." },
 { CONFIG_FILE ,0,"","config", Arg::Required,"  --config=<filename>  \tSpecifies config file." },
+{ CHECKPOINT_FILE ,0,"","checkpoint", Arg::Required,"  --checkpoint=<filename>  \tPeriodically saves mining progress to given file." },
+{ CHECKPOINT_INTERVAL ,0,"","checkpoint-interval", Arg::Numeric,"  --checkpoint-interval=<seconds>  \tTime between checkpoints (default is 600)." },
+{ RESUME, 0, "", "resume", Arg::None, "  \t--resume"
+										"  \tContinues mining from the last checkpoint" },
+{ PROFILE_OUTPUT ,0,"","profile-output", Arg::Required,"  --profile-output=<filename>  \tWrites profiling counters as JSON (profiling builds only)." },
+{ SHARD ,0,"","shard", Arg::Shard,"  --shard=<k/n>  \tMines k-th of n shards and writes partial results to output filename. "
+										"Shards split the work but don't reduce it: each compares its 1/n of base windows with "
+										"all windows, N^2/n comparisons, while one process skips windows claimed by earlier bases." },
 { 0, 0, 0, 0, 0, 0 } };
 
+static const size_t LoadQueueCapacity = 4;
+
 enum ReportType
 {
 	ReportTypeUnknown,
@@ -116,7 +154,12 @@ struct Settings
 {
 	Settings() : debugMode(false),
 		minerType(minerCandle),
-		reportType(Html)
+		reportType(Html),
+		checkpointInterval(600),
+		resume(false),
+		shardIndex(0),
+		shardCount(0),
+		merge(false)
 	{
 	}
 	std::list<std::string> inputFilename;
@@ -125,6 +168,14 @@ struct Settings
 	bool debugMode;
 	MinerType minerType;
 	ReportType reportType;
+	std::string checkpointFilename;
+	int checkpointInterval;
+	bool resume;
+	int shardIndex;
+	int shardCount;
+	bool merge;
+	std::vector<std::string> shardFilenames;
+	std::string profileFilename;
 };
 
 static Settings parseOptions(int argc, char** argv)
@@ -149,11 +200,26 @@ static Settings parseOptions(int argc, char** argv)
 		exit(0);
 	}
 
-	if(!options[INPUT_FILENAME])
+	if((parse.nonOptionsCount() > 0) && (std::string(parse.nonOption(0)) == "merge"))
+	{
+		settings.merge = true;
+		for(int i = 1; i < parse.nonOptionsCount(); i++)
+		{
+			settings.shardFilenames.push_back(parse.nonOption(i));
+		}
+		if(settings.shardFilenames.empty())
+			throw std::runtime_error("Should specify shard files to merge");
+	}
+	else if(parse.nonOptionsCount() > 0)
+	{
+		throw std::runtime_error(std::string("Unknown command: ") + parse.nonOption(0));
+	}
+
+	if(!options[INPUT_FILENAME] && !settings.merge)
 	{
 		throw std::runtime_error("Should specify input filename (--input-filename)");
 	}
-	for(option::Option* opt = options[INPUT_FILENAME].first(); opt; opt = opt->next())
+	for(option::Option* opt = options[INPUT_FILENAME] ? options[INPUT_FILENAME].first() : nullptr; opt; opt = opt->next())
 	{
 		settings.inputFilename.push_back(std::string(opt->arg));
 	}
@@ -207,62 +273,365 @@ static Settings parseOptions(int argc, char** argv)
 		}
 	}
 
+	if(options[CHECKPOINT_FILE])
+	{
+		settings.checkpointFilename = options[CHECKPOINT_FILE].arg;
+	}
+
+	if(options[CHECKPOINT_INTERVAL])
+	{
+		settings.checkpointInterval = lexical_cast<int>(options[CHECKPOINT_INTERVAL].arg);
+	}
+
+	if(options[SHARD])
+	{
+		sscanf(options[SHARD].arg, "%d/%d", &settings.shardIndex, &settings.shardCount);
+		if(settings.merge)
+			throw std::runtime_error("--shard can't be used with merge");
+	}
+
+	if(options[PROFILE_OUTPUT])
+	{
+		settings.profileFilename = options[PROFILE_OUTPUT].arg;
+	}
+
+	settings.resume = options[RESUME] ? true : false;
+	if(settings.resume && settings.checkpointFilename.empty())
+	{
+		throw std::runtime_error("Should specify checkpoint filename (--checkpoint) to resume");
+	}
+
 	settings.debugMode = options[DEBUG_MODE] ? true : false;
 	return settings;
 }
 
-int main(int argc, char** argv)
+static ReportBuilder::Ptr createReportBuilder(ReportType reportType)
 {
-	setlocale(LC_NUMERIC, NULL);
+	if(reportType == ReportType::Html)
+	{
+		return std::make_shared<HtmlReportBuilder>();
+	}
+	else if(reportType == ReportType::Txt)
+	{
+		return std::make_shared<TextReportBuilder>();
+	}
+	throw std::runtime_error("Invalid report type requested");
+}
 
-	Settings s = parseOptions(argc, argv);
+static IMiner::Ptr createMiner(MinerType minerType)
+{
+	if(minerType == minerCandle)
+	{
+		return std::make_shared<CandleMiner>();
+	}
+	else if(minerType == minerZigzag)
+	{
+		return std::make_shared<MinmaxMiner>();
+	}
+	throw std::runtime_error("Miner type is not supported");
+}
 
-	initLogging("pattern-mining.log", s.debugMode);
+/*
+ * Runs the miner once for every parameter set listed in "sweep" config array.
+ * Each set overrides keys of the main config ("report" is merged key by key)
+ * and produces its report with "-<index>" inserted before the extension of
+ * output filename (report.txt gives report-0.txt, report-1.txt, ...),
+ * unless the set gives its own output filename. Candle miners with the same
+ * pattern length share one PatternStore. "threads" of the main config (or
+ * hardware concurrency) is split between sets running at once.
+ */
+static void runSweep(const Settings& s, const Json::Value& root, const std::vector<Quotes::Ptr>& q)
+{
+	const Json::Value& sets = root["sweep"];
+	if(!sets.isArray())
+		throw std::runtime_error("'sweep' should be an array of parameter sets");
+
+	// Sets run in parallel, and each candle miner gets an equal share of the
+	// thread budget for its own worker threads
+	int budget = root.get("threads", 0).asInt();
+	if(budget <= 0)
+		budget = std::max(1u, std::thread::hardware_concurrency());
+	size_t threadsCount = std::min<size_t>(budget, sets.size());
+	int minerThreads = std::max<int>(1, budget / std::max<size_t>(1, threadsCount));
+
+	std::vector<IMiner::Ptr> miners;
+	std::vector<std::string> outputFilenames;
+	std::map<int, PatternStore::Ptr> stores;
+	for(Json::ArrayIndex i = 0; i < sets.size(); i++)
+	{
+		Json::Value config = root;
+		config.removeMember("sweep");
+		for(const auto& key : sets[i].getMemberNames())
+		{
+			if((key == "report") && config.isMember("report"))
+			{
+				for(const auto& reportKey : sets[i]["report"].getMemberNames())
+					config["report"][reportKey] = sets[i]["report"][reportKey];
+			}
+			else
+			{
+				config[key] = sets[i][key];
+			}
+		}
+		if(config.isMember("incremental-state") || config.isMember("out-of-core"))
+			throw std::runtime_error("Parameter sweep can't use incremental state or out-of-core mode");
 
-	std::vector<Quotes::Ptr> q;
-	std::list<std::string> tickers;
-	for(const auto& fname : s.inputFilename)
+		std::string outputFilename = sets[i]["report"].get("output-filename", "").asString();
+		if(outputFilename.empty())
+		{
+			boost::filesystem::path outputPath(root["report"].get("output-filename", s.outputFilename).asString());
+			outputFilename = (outputPath.parent_path() /
+					(outputPath.stem().string() + "-" + std::to_string(i) + outputPath.extension().string())).string();
+		}
+		config["report"]["output-filename"] = outputFilename;
+		if(!sets[i].isMember("threads"))
+			config["threads"] = minerThreads;
+
+		auto miner = createMiner(s.minerType);
+		miner->parseConfig(config);
+		auto candleMiner = std::dynamic_pointer_cast<CandleMiner>(miner);
+		if(candleMiner)
+		{
+			int patternLength = candleMiner->params().patternLength;
+			if(!stores[patternLength])
+				stores[patternLength] = std::make_shared<PatternStore>(q, patternLength);
+			candleMiner->setPatternStore(stores[patternLength]);
+		}
+		miner->setQuotes(q);
+		miners.push_back(miner);
+		outputFilenames.push_back(outputFilename);
+	}
+
+	std::atomic<size_t> next(0);
+	std::vector<std::exception_ptr> errors(miners.size());
+	auto worker = [&]() {
+		for(size_t i = next++; i < miners.size(); i = next++)
+		{
+			try
+			{
+				miners[i]->mine();
+				miners[i]->makeReport(createReportBuilder(s.reportType), outputFilenames[i]);
+				LOG(INFO) << "Parameter set " << i << " done: " << outputFilenames[i];
+			}
+			catch(...)
+			{
+				errors[i] = std::current_exception();
+			}
+			miners[i].reset();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(size_t i = 0; i < threadsCount; i++)
 	{
-		auto tq = std::make_shared<Quotes>();
-		tq->loadFromCsv(fname);
-		q.push_back(tq);
-		LOG(INFO) << "Loaded " << tq->name() << ", " << tq->length() << " points";
-		tickers.push_back(tq->name());
+		threads.emplace_back(worker);
+	}
+	for(auto& t : threads)
+	{
+		t.join();
 	}
 
-	ReportBuilder::Ptr report;
-	if(s.reportType == ReportType::Html)
+	for(const auto& e : errors)
 	{
-		report = std::make_shared<HtmlReportBuilder>();
+		if(e)
+			std::rethrow_exception(e);
 	}
-	else if(s.reportType == ReportType::Txt)
+}
+
+/*
+ * Load stage: parses quote files on several threads and passes them to out
+ * in input order. Parsed tickers wait for their turn, so no more than
+ * LoadQueueCapacity plus one per thread are held ahead of the consumer.
+ */
+static void loadQuotes(const std::vector<std::string>& filenames, BoundedQueue<Quotes::Ptr>& out)
+{
+	std::atomic<size_t> next(0);
+	size_t turn = 0;
+	bool failed = false;
+	std::mutex mutex;
+	std::condition_variable turnChanged;
+
+	auto worker = [&]() {
+		for(size_t i = next++; i < filenames.size(); i = next++)
+		{
+			auto tq = std::make_shared<Quotes>();
+			try
+			{
+				PROFILE_SCOPE("load");
+				tq->loadFromCsv(filenames[i]);
+			}
+			catch(...)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				failed = true;
+				turnChanged.notify_all();
+				out.close();
+				throw;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			turnChanged.wait(lock, [&]() { return failed || (turn == i); });
+			if(failed)
+				return;
+			lock.unlock();
+			LOG(INFO) << "Loaded " << tq->name() << ", " << tq->length() << " points";
+			bool accepted = out.push(tq);
+			lock.lock();
+			turn++;
+			turnChanged.notify_all();
+			if(!accepted)
+			{
+				failed = true;
+				return;
+			}
+		}
+	};
+
+	size_t threadsCount = std::max(1u, std::thread::hardware_concurrency());
+	threadsCount = std::min(threadsCount, std::max<size_t>(filenames.size(), 1));
+	std::vector<std::unique_ptr<Stage>> loaders;
+	for(size_t i = 0; i < threadsCount; i++)
 	{
-		report = std::make_shared<TextReportBuilder>();
+		loaders.emplace_back(new Stage(worker));
 	}
-	else
+	std::exception_ptr error;
+	for(auto& loader : loaders)
 	{
-		throw std::runtime_error("Invalid report type requested");
+		try
+		{
+			loader->join();
+		}
+		catch(...)
+		{
+			if(!error)
+				error = std::current_exception();
+		}
 	}
+	out.close();
+	if(error)
+		std::rethrow_exception(error);
+}
 
-	IMiner::Ptr miner;
-	if(s.minerType == minerCandle)
+/*
+ * Prints profiling summary when main() exits
+ */
+struct ProfileSummary
+{
+	ProfileSummary(const std::string& f) : filename(f)
 	{
-		miner = std::make_shared<CandleMiner>();
+#ifndef PATTERN_MINING_PROFILE
+		if(!filename.empty())
+			LOG(WARNING) << "Profiling is disabled in this build, --profile-output is ignored";
+#endif
 	}
-	else if(s.minerType == minerZigzag)
+
+	~ProfileSummary()
 	{
-		miner = std::make_shared<MinmaxMiner>();
+#ifdef PATTERN_MINING_PROFILE
+		std::ostringstream summary;
+		Profiler::instance().printSummary(summary);
+		LOG(INFO) << "Profile summary:\n" << summary.str();
+		if(!filename.empty())
+		{
+			try
+			{
+				Profiler::instance().writeJson(filename);
+			}
+			catch(const std::exception& e)
+			{
+				LOG(ERROR) << e.what();
+			}
+		}
+#endif
 	}
 
+	std::string filename;
+};
+
+int main(int argc, char** argv)
+{
+	setlocale(LC_NUMERIC, NULL);
+
+	Settings s = parseOptions(argc, argv);
+
+	initLogging("pattern-mining.log", s.debugMode);
+	ProfileSummary profileSummary(s.profileFilename);
+
+	ReportBuilder::Ptr report = createReportBuilder(s.reportType);
+	IMiner::Ptr miner = createMiner(s.minerType);
+
 	std::ifstream configFile(s.configFilename, std::fstream::binary);
 	if(!configFile.good())
 		throw std::runtime_error("Unable to open config file");
 	Json::Value root;
 	configFile >> root;
 
-	miner->parseConfig(root);
+	bool sweep = root.isMember("sweep");
+	if(sweep && (s.merge || (s.shardCount > 0) || !s.checkpointFilename.empty()))
+		throw std::runtime_error("Parameter sweep can't be combined with shards or checkpoints");
+
+	if(!sweep)
+		miner->parseConfig(root);
+	if(s.shardCount > 0)
+		miner->setShard(s.shardIndex, s.shardCount);
+	if(s.merge)
+	{
+		miner->mergeShards(s.shardFilenames);
+		miner->makeReport(report, s.outputFilename);
+		return 0;
+	}
+
+	// Candle windows are normalized and indexed as tickers arrive. Incremental
+	// state reorders tickers, so the miner builds its own store then. In
+	// out-of-core mode tickers are written to column files and released.
+	PatternStore::Ptr store;
+	auto candleMiner = std::dynamic_pointer_cast<CandleMiner>(miner);
+	bool outOfCore = !sweep && candleMiner && !candleMiner->params().outOfCoreDirectory.empty();
+	if(outOfCore && ((s.shardCount > 0) || !s.checkpointFilename.empty()))
+		throw std::runtime_error("Out-of-core mining can't be combined with shards or checkpoints");
+	if(!sweep && candleMiner && !outOfCore && !root.isMember("incremental-state"))
+		store = std::make_shared<PatternStore>(candleMiner->params().patternLength);
+
+	std::vector<Quotes::Ptr> q;
+	BoundedQueue<Quotes::Ptr> loaded(LoadQueueCapacity);
+	std::vector<std::string> filenames(s.inputFilename.begin(), s.inputFilename.end());
+	Stage load([&]() { loadQuotes(filenames, loaded); });
+	try
+	{
+		Quotes::Ptr tq;
+		while(loaded.pop(tq))
+		{
+			if(outOfCore)
+			{
+				candleMiner->spill(tq);
+				continue;
+			}
+			q.push_back(tq);
+			if(store)
+				store->append(tq);
+		}
+	}
+	catch(...)
+	{
+		loaded.close();
+		throw;
+	}
+	load.join();
+
+	if(sweep)
+	{
+		runSweep(s, root, q);
+		return 0;
+	}
+	if(store)
+		candleMiner->setPatternStore(store);
+
+	miner->setCheckpoint(s.checkpointFilename, s.checkpointInterval, s.resume);
 	miner->setQuotes(q);
 	miner->mine();
-	miner->makeReport(report, s.outputFilename);
+	if(s.shardCount > 0)
+		miner->saveShard(s.outputFilename);
+	else
+		miner->makeReport(report, s.outputFilename);
 }
 
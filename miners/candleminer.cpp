@@ -1,356 +1,2049 @@
 #include <cassert>
 #include "log.h"
 #include <cmath>
-#include <boost/math/distributions.hpp> 
+#include <limits>
 #include "candleminer.h"
+#include "binaryio.h"
+#include "profiler.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "statistics.h"
+#include <boost/filesystem.hpp>
+#include <atomic>
+#include <random>
+#include <thread>
 
-using namespace boost::math;
+#ifdef WIN32
+#define gmtime_r(t, tm) gmtime_s(tm, t)
+#endif
 
 static const int MaxPatternLength = 32;
+static const size_t AggregateQueueCapacity = 1024;
 
-static const double alpha[] = { 0.00001, 0.0001, 0.001, 0.01, 0.05, 0.10, 0.25, 0.5, 1 };
+// Fit keys of 4096 candidates take 100 KB, so a candidate tile stays in L2
+// while a tile of bases is compared with it
+static const size_t TileBases = 64;
+static const size_t TileCandidates = 4096;
 
-struct SignatureElement
+static const size_t MinBlockWindows = 1024;
+
+static bool fitCandle(const FitElement& e1, const FitElement& e2, bool compareOpen, double tolerance)
+{
+	if(fabs(e1.close - e2.close) > tolerance)
+	{
+		PROFILE_COUNT("fit.reject.tolerance");
+		return false;
+	}
+	if(fabs(e1.high - e2.high) > tolerance)
+	{
+		PROFILE_COUNT("fit.reject.tolerance");
+		return false;
+	}
+	if(fabs(e1.low - e2.low) > tolerance)
+	{
+		PROFILE_COUNT("fit.reject.tolerance");
+		return false;
+	}
+	if(compareOpen && (fabs(e1.open - e2.open) > tolerance))
+	{
+		PROFILE_COUNT("fit.reject.tolerance");
+		return false;
+	}
+	if((e1.open - e1.close) * (e2.open - e2.close) < 0)
+	{
+		PROFILE_COUNT("fit.reject.body-sign");
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Candles I, I - 1, ..., 0 unrolled at compile time
+ */
+template <int I>
+struct CandlesFit
+{
+	static bool check(const FitElement* e1, const FitElement* e2, double tolerance)
+	{
+		return fitCandle(e1[I], e2[I], I > 0, tolerance) && CandlesFit<I - 1>::check(e1, e2, tolerance);
+	}
+};
+
+template <>
+struct CandlesFit<-1>
+{
+	static bool check(const FitElement*, const FitElement*, double)
+	{
+		return true;
+	}
+};
+
+/*
+ * Checks are ordered by their rejection rates measured over random window
+ * pairs: the last close rejects about 80% of candidates, the O(1) window
+ * range test (necessary for highs and lows to fit) comes next, and later
+ * candles drift further from the common open than earlier ones. Opens of
+ * the first candles are both 1 and never compared.
+ *
+ * Momentum sign is not compared: fit() and matches() check it first, and
+ * tiled scans only pair windows of one momentum bucket.
+ *
+ * Length is the pattern length known at compile time, or 0 to take it from
+ * length argument.
+ */
+template <int Length>
+static bool fitPatterns(const CandlePattern& f1, const CandlePattern& f2, int length, const CandleMiner::Params& params)
+{
+	const int n = Length > 0 ? Length : length;
+	const FitElement* el1 = f1.elements.data();
+	const FitElement* el2 = f2.elements.data();
+	double tolerance = (std::max(f1.high, f2.high) - std::min(f1.low, f2.low)) * params.candleFit;
+	if(fabs(el1[n - 1].close - el2[n - 1].close) > tolerance)
+	{
+		PROFILE_COUNT("fit.reject.tolerance");
+		return false;
+	}
+	if((fabs(f1.high - f2.high) > tolerance) || (fabs(f1.low - f2.low) > tolerance))
+	{
+		PROFILE_COUNT("fit.reject.range");
+		return false;
+	}
+	if(Length > 0)
+	{
+		if(!CandlesFit<Length - 1>::check(el1, el2, tolerance))
+			return false;
+	}
+	else
+	{
+		for(int i = n - 1; i >= 0; i--)
+		{
+			if(!fitCandle(el1[i], el2[i], i > 0, tolerance))
+				return false;
+		}
+	}
+	if(params.volumeFit > 0)
+	{
+		for(int i = 0; i < n; i++)
+		{
+			if(fabs(el1[i].volume - el2[i].volume) > params.volumeFit)
+			{
+				PROFILE_COUNT("fit.reject.volume");
+				return false;
+			}
+		}
+	}
+	if(params.fitSignatures)
+	{
+		if(f1.signature != f2.signature)
+		{
+			PROFILE_COUNT("fit.reject.signature");
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Conservative fit test on quantized rows: rejects only windows that fit()
+ * rejects too. Every quantized price is within half a unit of the exact one,
+ * so tolerance is taken over the widest range the rows allow and one unit is
+ * allowed for the difference; another half unit covers double rounding.
+ *
+ * With compile-time Length, prices are reduced to the largest difference
+ * without branches, which vectorizes.
+ */
+template <int Length>
+static bool quantizedFit(const int16_t* q1, const int16_t* q2, int length, double candleFit)
+{
+	if(!q1[0] || !q2[0])
+		return true;
+
+	const int n = Length > 0 ? Length : length;
+	int range = std::max(q1[2], q2[2]) - std::min(q1[1], q2[1]);
+	int limit = (range + 1) * candleFit + 1.5;
+	int lastClose = 3 + 4 * (n - 1);
+	if(std::abs(q1[lastClose] - q2[lastClose]) > limit)
+		return false;
+	if((std::abs(q1[1] - q2[1]) > limit) || (std::abs(q1[2] - q2[2]) > limit))
+		return false;
+	if(Length > 0)
+	{
+		int worst = 0;
+		for(int i = 3; i < 3 + 4 * n; i++)
+			worst = std::max(worst, std::abs(q1[i] - q2[i]));
+		return worst <= limit;
+	}
+	for(int i = 3 + 4 * n - 1; i >= 3; i--)
+	{
+		if(std::abs(q1[i] - q2[i]) > limit)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Kernels specialized for common pattern lengths, generic ones otherwise
+ */
+template <int Length>
+static void setKernels(CandleMiner::FitKernel& fit, CandleMiner::QuantizedFitKernel& quantized)
+{
+	fit = fitPatterns<Length>;
+	quantized = quantizedFit<Length>;
+}
+
+void CandleMiner::selectKernels()
+{
+	switch(m_params.patternLength)
+	{
+		case 2: setKernels<2>(m_fitKernel, m_quantizedFitKernel); break;
+		case 3: setKernels<3>(m_fitKernel, m_quantizedFitKernel); break;
+		case 4: setKernels<4>(m_fitKernel, m_quantizedFitKernel); break;
+		case 5: setKernels<5>(m_fitKernel, m_quantizedFitKernel); break;
+		case 6: setKernels<6>(m_fitKernel, m_quantizedFitKernel); break;
+		case 7: setKernels<7>(m_fitKernel, m_quantizedFitKernel); break;
+		case 8: setKernels<8>(m_fitKernel, m_quantizedFitKernel); break;
+		default: setKernels<0>(m_fitKernel, m_quantizedFitKernel); break;
+	}
+}
+
+bool CandleMiner::fit(const Pattern& f1, const Pattern& f2, int length)
+{
+	if(f1.momentumSign != f2.momentumSign)
+		return false;
+	if(length == m_params.patternLength)
+		return m_fitKernel(f1, f2, length, m_params);
+	return fitPatterns<0>(f1, f2, length, m_params);
+}
+
+CandleMiner::CandleMiner()
+{
+	normalizeExitHorizons();
+	selectKernels();
+}
+
+CandleMiner::CandleMiner(const Params& p) : m_params(p)
+{
+	assert(m_params.patternLength < MaxPatternLength);
+	normalizeExitHorizons();
+	selectKernels();
+}
+
+void CandleMiner::normalizeExitHorizons()
+{
+	auto& horizons = m_params.exitHorizons;
+	if(horizons.empty())
+		horizons.push_back(m_params.exitAfter);
+	std::sort(horizons.begin(), horizons.end());
+	horizons.erase(std::unique(horizons.begin(), horizons.end()), horizons.end());
+	if(horizons.front() <= 0)
+		throw std::runtime_error("Exit horizons should be positive");
+	m_params.exitAfter = horizons.back();
+}
+
+CandleMiner::~CandleMiner()
+{
+	// Column files are copies of the input, so they don't outlive the miner
+	std::vector<std::string> filenames;
+	filenames.swap(m_spilledFilenames);
+	m_columnFiles.clear();
+	for(const auto& filename : filenames)
+	{
+		boost::system::error_code error;
+		boost::filesystem::remove(filename, error);
+	}
+}
+
+size_t CandleMiner::windowCount(const Quotes::Ptr& q) const
+{
+	return windowCount(q->length());
+}
+
+size_t CandleMiner::windowCount(size_t candles) const
+{
+	size_t reserved = m_params.patternLength + m_params.exitAfter;
+	if(candles <= reserved)
+		return 0;
+	return candles - reserved;
+}
+
+void CandleMiner::buildPatterns(const std::vector<Quotes::Ptr>& qlist)
+{
+	if(!m_store || (m_store->quotes() != qlist) || (m_store->patternLength() != m_params.patternLength))
+		m_store = std::make_shared<PatternStore>(qlist, m_params.patternLength);
+
+	if(m_params.quantizedPrefilter)
+		m_store->buildQuantized();
+
+	m_momentum.resize(m_store->size());
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+	for(size_t ticker = 0; ticker < qlist.size(); ticker++)
+	{
+		auto momentum = momentumColumn(*qlist[ticker], m_params.momentumOrder);
+		buildColumns(*qlist[ticker], momentum, ticker, windowCount(qlist[ticker]));
+	}
+}
+
+/*
+ * Excursion tables, momentum signs and momentum buckets of the first
+ * windows of given store ticker
+ */
+void CandleMiner::buildColumns(const Quotes& q, const std::vector<int8_t>& momentum, size_t ticker, size_t windows)
+{
+	std::vector<double> lows;
+	std::vector<double> highs;
+	for(size_t pos = 0; pos < q.length(); pos++)
+	{
+		lows.push_back(q[pos].low);
+		highs.push_back(q[pos].high);
+	}
+	m_lows.emplace_back(lows, m_params.exitAfter);
+	m_highs.emplace_back(highs, m_params.exitAfter);
+
+	std::copy(momentum.begin(), momentum.begin() + m_store->windows(ticker), m_momentum.begin() + m_store->offset(ticker));
+	m_buckets.emplace_back(momentum, windows);
+}
+
+CandleMiner::Pattern CandleMiner::pattern(size_t id) const
+{
+	Pattern p = (*m_store)[id];
+	p.momentumSign = m_momentum[id];
+	return p;
+}
+
+std::vector<int16_t> CandleMiner::quantizedRow(const Pattern& p) const
+{
+	std::vector<int16_t> row;
+	if(m_params.quantizedPrefilter)
+	{
+		row.resize(PatternStore::quantizedStride(m_params.patternLength));
+		PatternStore::quantize(p, row.data());
+	}
+	return row;
+}
+
+bool CandleMiner::matches(const Base& base, size_t id)
+{
+	PROFILE_COUNT("fit.calls");
+	if(base.pattern.momentumSign != m_momentum[id])
+	{
+		PROFILE_COUNT("fit.reject.momentum");
+		return false;
+	}
+	if(!base.quantized.empty() &&
+			!m_quantizedFitKernel(base.quantized.data(), m_store->quantized(id), m_params.patternLength, m_params.candleFit))
+	{
+		PROFILE_COUNT("fit.reject.quantized");
+		return false;
+	}
+	return m_fitKernel(base.pattern, (*m_store)[id], m_params.patternLength, m_params);
+}
+
+/*
+ * Compares bases with every bucket window of their momentum sign, tile by
+ * tile: fit keys of a tile of candidates are gathered once and scanned by a
+ * tile of bases, and only candidates passing the key tests are fitted in
+ * full. Key tests are the first tests of the fit kernel, done the same way,
+ * so matches are the same as from matches() over all candidates. Every
+ * base gets its matches in window order. Windows of a ticker below
+ * firstScan are skipped, unless firstScan is empty. Returns the number of
+ * compared pairs.
+ */
+size_t CandleMiner::matchTiled(const std::vector<Base*>& bases, const std::vector<size_t>& firstScan,
+		const std::function<void(size_t base, size_t ticker, uint32_t pos)>& onMatch)
+{
+	const double* lastCloses = m_store->lastCloses();
+	const double* rangeLows = m_store->rangeLows();
+	const double* rangeHighs = m_store->rangeHighs();
+	double candleFit = m_params.candleFit;
+	std::vector<double> closes(TileCandidates);
+	std::vector<double> lows(TileCandidates);
+	std::vector<double> highs(TileCandidates);
+	std::vector<uint8_t> pass(TileCandidates);
+
+	size_t compared = 0;
+	for(int sign = -1; sign <= 1; sign++)
+	{
+		std::vector<size_t> group;
+		for(size_t b = 0; b < bases.size(); b++)
+		{
+			if(bases[b]->pattern.momentumSign == sign)
+				group.push_back(b);
+		}
+
+		for(size_t groupStart = 0; groupStart < group.size(); groupStart += TileBases)
+		{
+			size_t groupEnd = std::min(groupStart + TileBases, group.size());
+			for(size_t ticker = 0; ticker < m_buckets.size(); ticker++)
+			{
+				const auto& bucket = m_buckets[ticker][sign];
+				auto first = firstScan.empty() ? bucket.begin() : std::lower_bound(bucket.begin(), bucket.end(), firstScan[ticker]);
+				size_t offset = m_store->offset(ticker);
+				for(auto tile = first; tile != bucket.end(); )
+				{
+					size_t n = std::min<size_t>(TileCandidates, bucket.end() - tile);
+					for(size_t i = 0; i < n; i++)
+					{
+						size_t id = offset + tile[i];
+						closes[i] = lastCloses[id];
+						lows[i] = rangeLows[id];
+						highs[i] = rangeHighs[id];
+					}
+
+					for(size_t g = groupStart; g < groupEnd; g++)
+					{
+						const Base& base = *bases[group[g]];
+						double close = base.pattern.elements.back().close;
+						double low = base.pattern.low;
+						double high = base.pattern.high;
+						for(size_t i = 0; i < n; i++)
+						{
+							double tolerance = (std::max(high, highs[i]) - std::min(low, lows[i])) * candleFit;
+							pass[i] = !(fabs(close - closes[i]) > tolerance) & !(fabs(high - highs[i]) > tolerance) &
+								!(fabs(low - lows[i]) > tolerance);
+						}
+						for(size_t i = 0; i < n; i++)
+						{
+							if(pass[i] && matches(base, offset + tile[i]))
+								onMatch(group[g], ticker, tile[i]);
+						}
+						compared += n;
+					}
+					tile += n;
+				}
+			}
+		}
+	}
+	return compared;
+}
+
+void CandleMiner::setPatternStore(const PatternStore::Ptr& store)
+{
+	m_store = store;
+}
+
+void CandleMiner::addMatch(Accumulator& acc, size_t ticker, size_t scanPos)
+{
+	PROFILE_SCOPE("match");
+	const auto& horizons = m_params.exitHorizons;
+	if(acc.min_low.empty())
+	{
+		acc.min_low.assign(horizons.size(), 1.0);
+		acc.max_high.assign(horizons.size(), -1.0);
+	}
+
+	const auto& qscan = m_store->quotes()[ticker];
+	size_t nextPos = scanPos + m_params.patternLength;
+	double entry = qscan->at(nextPos).open;
+	for(size_t h = 0; h < horizons.size(); h++)
+	{
+		size_t exitPos = nextPos + horizons[h] - 1;
+		double low = m_lows[ticker].query(nextPos, exitPos);
+		double high = m_highs[ticker].query(nextPos, exitPos);
+		acc.returns.push_back((qscan->at(exitPos).close - entry) / entry);
+		acc.min_low[h] = std::min(acc.min_low[h], (low - entry) / entry);
+		acc.max_high[h] = std::max(acc.max_high[h], (high - entry) / entry);
+	}
+}
+
+void CandleMiner::doMine(std::vector<Quotes::Ptr>& qlist)
+{
+	buildPatterns(qlist);
+	bool resumed = !m_scan.scanned.empty();
+	if(!resumed)
+	{
+		m_scan.ticker = 0;
+		m_scan.pos = 0;
+		m_scan.scanned.assign(m_store->size(), 0);
+	}
+	else if(m_scan.scanned.size() != m_store->size())
+	{
+		throw std::runtime_error("Checkpoint does not match loaded quotes");
+	}
+
+	std::vector<size_t> firstNew(qlist.size(), 0);
+	for(size_t i = 0; i < m_mined.size(); i++)
+	{
+		firstNew[i] = m_mined[i].windows;
+	}
+
+	size_t newWindows = 0;
+	for(size_t i = 0; i < qlist.size(); i++)
+	{
+		newWindows += windowCount(qlist[i]) - firstNew[i];
+	}
+	Progress progress("CandleMiner", newWindows);
+
+	// Aggregate stage: statistics of finished bases are calculated while
+	// later bases are still being matched. Bases are passed in m_bases order,
+	// so results come in the same order as from makeResults().
+	m_results.clear();
+	m_resultArena.clear();
+	BoundedQueue<const Base*> finished(AggregateQueueCapacity);
+	Stage aggregate([&]() {
+			try
+			{
+				const Base* base;
+				while(finished.pop(base))
+				{
+					Result r;
+					if(makeResult(*base, r))
+						m_results.push_back(r);
+				}
+			}
+			catch(...)
+			{
+				finished.close();
+				throw;
+			}
+		});
+	try
+	{
+		matchBases(qlist, firstNew, resumed, progress, finished);
+	}
+	catch(...)
+	{
+		finished.close();
+		throw;
+	}
+	finished.close();
+	aggregate.join();
+
+	m_scan.scanned.clear();
+	m_scan.scanned.shrink_to_fit();
+
+	updateMined(qlist);
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+/*
+ * Match stage of doMine(): every base that won't claim more windows is
+ * passed to the aggregate stage. Stops if the aggregate stage has failed.
+ */
+void CandleMiner::matchBases(std::vector<Quotes::Ptr>& qlist, const std::vector<size_t>& firstNew, bool resumed,
+		Progress& progress, BoundedQueue<const Base*>& finished)
+{
+	auto& scanned = m_scan.scanned;
+	if(resumed)
+	{
+		// Checkpointed bases already claimed their windows
+		for(const auto& base : m_bases)
+			if(!finished.push(&base))
+				return;
+	}
+
+	// Bases persisted by previous runs come first in scan order and claim
+	// every appended window that fits them
+	for(size_t tileStart = 0; !resumed && (tileStart < m_bases.size()); tileStart += TileBases)
+	{
+		std::vector<Base*> bases;
+		std::vector<size_t> before;
+		for(size_t i = tileStart; i < std::min(tileStart + TileBases, m_bases.size()); i++)
+		{
+			m_bases[i].quantized = quantizedRow(m_bases[i].pattern);
+			bases.push_back(&m_bases[i]);
+			before.push_back(m_bases[i].acc.returns.size());
+		}
+		size_t compared = matchTiled(bases, firstNew, [&](size_t b, size_t ticker, uint32_t pos) {
+				addMatch(bases[b]->acc, ticker, pos);
+				scanned[m_store->offset(ticker) + pos] = 1;
+			});
+		progress.addComparisons(compared);
+		m_comparisons += compared;
+		for(size_t b = 0; b < bases.size(); b++)
+		{
+			progress.addMatches((bases[b]->acc.returns.size() - before[b]) / m_params.exitHorizons.size());
+			if(!finished.push(bases[b]))
+				return;
+		}
+	}
+
+	for(size_t baseIndex = m_scan.ticker; baseIndex < qlist.size(); baseIndex++)
+	{
+		const auto& qbase = qlist[baseIndex];
+		size_t offset = m_store->offset(baseIndex);
+		size_t startPos = firstNew[baseIndex];
+		if(baseIndex == m_scan.ticker)
+			startPos = std::max(startPos, m_scan.pos);
+		size_t endPos = startPos;
+		while((endPos < windowCount(qbase)) &&
+				((m_params.limit <= 0) || ((double)endPos / qbase->length() * 100 <= (size_t)m_params.limit)))
+			endPos++;
+
+		for(size_t tileStart = startPos; tileStart < endPos; tileStart += TileBases)
+		{
+			if(checkpointDue())
+			{
+				m_scan.ticker = baseIndex;
+				m_scan.pos = tileStart;
+				saveCheckpoint(qlist);
+			}
+
+			// Earlier tiles have claimed their windows already, so bases of
+			// the tile are found by comparing its windows with each other
+			size_t tileEnd = std::min(tileStart + TileBases, endPos);
+			std::vector<Base> tile;
+			for(size_t pos = tileStart; pos < tileEnd; pos++)
+			{
+				progress.advance();
+				if(scanned[offset + pos])
+					continue;
+
+				Base base;
+				base.ticker = baseIndex;
+				base.pos = pos;
+				base.pattern = pattern(offset + pos);
+				base.quantized = quantizedRow(base.pattern);
+				for(size_t later = pos + 1; later < tileEnd; later++)
+				{
+					if(!scanned[offset + later] && matches(base, offset + later))
+						scanned[offset + later] = 1;
+				}
+				tile.push_back(std::move(base));
+			}
+
+			std::vector<Base*> bases;
+			for(auto& base : tile)
+				bases.push_back(&base);
+			size_t compared = matchTiled(bases, std::vector<size_t>(), [&](size_t b, size_t ticker, uint32_t pos) {
+					addMatch(tile[b].acc, ticker, pos);
+					scanned[m_store->offset(ticker) + pos] = 1;
+				});
+			progress.addComparisons(compared);
+			m_comparisons += compared;
+			for(auto& base : tile)
+			{
+				progress.addMatches(base.acc.returns.size() / m_params.exitHorizons.size());
+				m_bases.push_back(std::move(base));
+				if(!finished.push(&m_bases.back()))
+					return;
+			}
+		}
+	}
+
+	if(!m_checkpointFilename.empty())
+	{
+		m_scan.ticker = qlist.size();
+		m_scan.pos = 0;
+		saveCheckpoint(qlist);
+	}
+}
+
+void CandleMiner::updateMined(const std::vector<Quotes::Ptr>& qlist)
+{
+	m_mined.resize(qlist.size());
+	for(size_t i = 0; i < qlist.size(); i++)
+	{
+		m_mined[i].name = qlist[i]->name();
+		m_mined[i].candles = qlist[i]->length();
+		m_mined[i].windows = windowCount(qlist[i]);
+		m_mined[i].lastTime = qlist[i]->length() > 0 ? qlist[i]->at(qlist[i]->length() - 1).time.sec : 0;
+	}
+}
+
+/*
+ * Every base position of the shard collects all windows it fits, whether or
+ * not an earlier base would have claimed it. mergeShards() then replays the
+ * greedy 'scanned' pass over all shards in window order, which gives exactly
+ * the same bases as a single process run.
+ */
+void CandleMiner::doMineShard(std::vector<Quotes::Ptr>& qlist)
+{
+	buildPatterns(qlist);
+	if(m_store->size() > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("Too many windows for sharded mining");
+
+	size_t scanWindows = 0;
+	for(const auto& q : qlist)
+		scanWindows += windowCount(q);
+	Progress progress("CandleMiner shard " + std::to_string(m_shardIndex), scanWindows / m_shardCount);
+
+	std::vector<Base> tile;
+	auto matchTile = [&]() {
+		std::vector<Base*> bases;
+		for(auto& base : tile)
+			bases.push_back(&base);
+		size_t compared = matchTiled(bases, std::vector<size_t>(), [&](size_t b, size_t ticker, uint32_t pos) {
+				addMatch(tile[b].acc, ticker, pos);
+				tile[b].matches.push_back(m_store->offset(ticker) + pos);
+			});
+		progress.addComparisons(compared);
+		m_comparisons += compared;
+		for(auto& base : tile)
+		{
+			progress.addMatches(base.matches.size());
+			m_bases.push_back(std::move(base));
+		}
+		tile.clear();
+	};
+
+	for(size_t baseIndex = 0; baseIndex < qlist.size(); baseIndex++)
+	{
+		const auto& qbase = qlist[baseIndex];
+		for(size_t pos = 0; pos < windowCount(qbase); pos++)
+		{
+			if(m_params.limit > 0)
+			{
+				if((double)pos / qbase->length() * 100 > (size_t)m_params.limit)
+					break;
+			}
+
+			if((m_store->offset(baseIndex) + pos) % m_shardCount != (size_t)m_shardIndex)
+				continue;
+			progress.advance();
+
+			Base base;
+			base.ticker = baseIndex;
+			base.pos = pos;
+			base.pattern = pattern(m_store->offset(baseIndex) + pos);
+			base.quantized = quantizedRow(base.pattern);
+			tile.push_back(std::move(base));
+			if(tile.size() == TileBases)
+				matchTile();
+		}
+	}
+	matchTile();
+
+	updateMined(qlist);
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+int CandleMiner::threadCount() const
+{
+	if(m_params.threads > 0)
+		return m_params.threads;
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+CandleMiner::WindowList CandleMiner::listWindows(const std::vector<Quotes::Ptr>& qlist) const
+{
+	WindowList windows;
+	for(size_t ticker = 0; ticker < qlist.size(); ticker++)
+	{
+		const auto& q = qlist[ticker];
+		for(size_t pos = 0; pos < windowCount(q); pos++)
+		{
+			windows.ticker.push_back(ticker);
+			windows.pos.push_back(pos);
+			windows.eligible.push_back((m_params.limit <= 0) || ((double)pos / q->length() * 100 <= (size_t)m_params.limit));
+		}
+	}
+	if(windows.ticker.size() > std::numeric_limits<uint32_t>::max())
+		throw std::runtime_error("Too many windows for match graph");
+	return windows;
+}
+
+/*
+ * Compares every pair i < j of windows once, as fit() is symmetric. Pairs
+ * of two ineligible windows are skipped if skipIneligible is set. Rows are
+ * handed out to threads in small blocks, as shorter rows come last.
+ */
+void CandleMiner::findFitPairs(const WindowList& windows,
+		const std::function<void(int thread, uint32_t i, uint32_t j)>& onPair, int threads, bool skipIneligible)
+{
+	const size_t RowBlock = 64;
+	size_t count = windows.ticker.size();
+	Progress progress("CandleMiner match graph", count);
+	std::atomic<size_t> nextRow(0);
+	std::atomic<uint64_t> comparisons(0);
+	std::vector<std::exception_ptr> errors(threads);
+
+	auto worker = [&](int thread) {
+		try
+		{
+			uint64_t localComparisons = 0;
+			uint64_t localMatches = 0;
+			for(size_t first = nextRow.fetch_add(RowBlock); first < count; first = nextRow.fetch_add(RowBlock))
+			{
+				for(size_t i = first; i < std::min(first + RowBlock, count); i++)
+				{
+					Base base;
+					base.pattern = pattern(m_store->offset(windows.ticker[i]) + windows.pos[i]);
+					base.quantized = quantizedRow(base.pattern);
+					for(size_t j = i + 1; j < count; j++)
+					{
+						if(skipIneligible && !windows.eligible[i] && !windows.eligible[j])
+							continue;
+						localComparisons++;
+						if(matches(base, m_store->offset(windows.ticker[j]) + windows.pos[j]))
+						{
+							onPair(thread, i, j);
+							localMatches++;
+						}
+					}
+					progress.advance();
+				}
+				progress.addComparisons(localComparisons);
+				progress.addMatches(localMatches);
+				comparisons += localComparisons;
+				localComparisons = 0;
+				localMatches = 0;
+			}
+		}
+		catch(...)
+		{
+			errors[thread] = std::current_exception();
+			nextRow = count;
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for(int t = 0; t < threads; t++)
+	{
+		pool.emplace_back(worker, t);
+	}
+	for(auto& t : pool)
+	{
+		t.join();
+	}
+	for(const auto& e : errors)
+	{
+		if(e)
+			std::rethrow_exception(e);
+	}
+	m_comparisons += comparisons;
+}
+
+CandleMiner::MatchGraph CandleMiner::buildMatchGraph(const WindowList& windows)
+{
+	PROFILE_SCOPE("match-graph");
+	int threads = threadCount();
+	std::vector<std::vector<std::pair<uint32_t, uint32_t>>> pairs(threads);
+	findFitPairs(windows, [&](int thread, uint32_t i, uint32_t j) {
+			pairs[thread].emplace_back(i, j);
+		}, threads, true);
+
+	size_t count = windows.ticker.size();
+	MatchGraph graph;
+	graph.offsets.assign(count + 1, 0);
+	for(const auto& list : pairs)
+	{
+		for(const auto& p : list)
+		{
+			graph.offsets[p.first + 1]++;
+			graph.offsets[p.second + 1]++;
+		}
+	}
+	for(size_t i = 0; i < count; i++)
+	{
+		graph.offsets[i + 1] += graph.offsets[i];
+	}
+
+	graph.adjacent.resize(graph.offsets[count]);
+	std::vector<uint64_t> fill(graph.offsets.begin(), graph.offsets.end() - 1);
+	for(auto& list : pairs)
+	{
+		for(const auto& p : list)
+		{
+			graph.adjacent[fill[p.first]++] = p.second;
+			graph.adjacent[fill[p.second]++] = p.first;
+		}
+		list.clear();
+		list.shrink_to_fit();
+	}
+	for(size_t i = 0; i < count; i++)
+	{
+		std::sort(graph.adjacent.begin() + graph.offsets[i], graph.adjacent.begin() + graph.offsets[i + 1]);
+	}
+	return graph;
+}
+
+/*
+ * Replays the greedy 'scanned' pass over the match graph. Every window fits
+ * itself, so a base matches itself and its neighbours, in window order as
+ * doMine() scans them.
+ */
+void CandleMiner::doMineGraph(std::vector<Quotes::Ptr>& qlist)
+{
+	buildPatterns(qlist);
+	auto windows = listWindows(qlist);
+	auto graph = buildMatchGraph(windows);
+
+	size_t count = windows.ticker.size();
+	std::vector<uint8_t> scanned(count, 0);
+	for(size_t b = 0; b < count; b++)
+	{
+		if(!windows.eligible[b] || scanned[b])
+			continue;
+
+		Base base;
+		base.ticker = windows.ticker[b];
+		base.pos = windows.pos[b];
+		base.pattern = pattern(m_store->offset(base.ticker) + base.pos);
+
+		auto first = graph.adjacent.begin() + graph.offsets[b];
+		auto last = graph.adjacent.begin() + graph.offsets[b + 1];
+		auto self = std::lower_bound(first, last, (uint32_t)b);
+		auto claim = [&](uint32_t k) {
+			addMatch(base.acc, windows.ticker[k], windows.pos[k]);
+			scanned[k] = 1;
+		};
+		std::for_each(first, self, claim);
+		claim(b);
+		std::for_each(self, last, claim);
+		m_bases.push_back(std::move(base));
+	}
+
+	updateMined(qlist);
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+static uint32_t findRoot(std::vector<std::atomic<uint32_t>>& parent, uint32_t i)
+{
+	uint32_t p = parent[i].load(std::memory_order_relaxed);
+	while(p != i)
+	{
+		// Path halving, harmless if another thread has moved i already
+		uint32_t grandparent = parent[p].load(std::memory_order_relaxed);
+		parent[i].compare_exchange_weak(p, grandparent, std::memory_order_relaxed);
+		i = grandparent;
+		p = parent[i].load(std::memory_order_relaxed);
+	}
+	return i;
+}
+
+/*
+ * Lock-free union: larger root is always linked under smaller one, so root
+ * of every set is its smallest window and result doesn't depend on order
+ */
+static void unite(std::vector<std::atomic<uint32_t>>& parent, uint32_t i, uint32_t j)
+{
+	while(true)
+	{
+		i = findRoot(parent, i);
+		j = findRoot(parent, j);
+		if(i == j)
+			return;
+		if(i > j)
+			std::swap(i, j);
+		uint32_t expected = j;
+		if(parent[j].compare_exchange_strong(expected, i, std::memory_order_acq_rel))
+			return;
+	}
+}
+
+/*
+ * Groups windows into connected components of the fit relation. Every
+ * cluster with an eligible window gives one pattern: its first eligible
+ * window is the representative and all cluster windows are accumulated
+ * once, in window order. As clusters are transitive closures, windows at
+ * the ends of a long chain may not fit each other directly.
+ */
+void CandleMiner::doMineClusters(std::vector<Quotes::Ptr>& qlist)
+{
+	buildPatterns(qlist);
+	auto windows = listWindows(qlist);
+	size_t count = windows.ticker.size();
+
+	std::vector<std::atomic<uint32_t>> parent(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		parent[i].store(i, std::memory_order_relaxed);
+	}
+	{
+		PROFILE_SCOPE("clusters");
+		// Ineligible windows can't be bases, but still connect components
+		findFitPairs(windows, [&](int, uint32_t i, uint32_t j) {
+				unite(parent, i, j);
+			}, threadCount(), false);
+	}
+
+	const uint32_t None = std::numeric_limits<uint32_t>::max();
+	std::vector<uint32_t> baseIndex(count, None);
+	std::vector<uint32_t> roots(count);
+	for(size_t k = 0; k < count; k++)
+	{
+		roots[k] = findRoot(parent, k);
+		if(windows.eligible[k] && (baseIndex[roots[k]] == None))
+		{
+			baseIndex[roots[k]] = m_bases.size();
+			Base base;
+			base.ticker = windows.ticker[k];
+			base.pos = windows.pos[k];
+			base.pattern = pattern(m_store->offset(base.ticker) + base.pos);
+			m_bases.push_back(std::move(base));
+		}
+	}
+	for(size_t k = 0; k < count; k++)
+	{
+		uint32_t b = baseIndex[roots[k]];
+		if(b != None)
+			addMatch(m_bases[b].acc, windows.ticker[k], windows.pos[k]);
+	}
+
+	updateMined(qlist);
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+static const uint8_t SplitNone = 0;
+static const uint8_t SplitTrain = 1;
+static const uint8_t SplitTest = 2;
+
+/*
+ * Windows are split by ticker or by date. A window is in the training part
+ * only if its last exit candle is before split time, so no forward return
+ * leaks across the split; windows straddling it are used by neither part.
+ */
+std::vector<uint8_t> CandleMiner::splitWindows(const std::vector<Quotes::Ptr>& qlist, const WindowList& windows) const
+{
+	std::vector<uint8_t> split(windows.ticker.size(), SplitNone);
+	for(size_t k = 0; k < split.size(); k++)
+	{
+		const auto& q = qlist[windows.ticker[k]];
+		if(!m_params.testTickers.empty())
+		{
+			bool test = std::find(m_params.testTickers.begin(), m_params.testTickers.end(), q->name()) !=
+				m_params.testTickers.end();
+			split[k] = test ? SplitTest : SplitTrain;
+		}
+		else if(q->at(windows.pos[k] + m_params.patternLength + m_params.exitAfter - 1).time.sec < m_params.splitTime)
+		{
+			split[k] = SplitTrain;
+		}
+		else if(q->at(windows.pos[k]).time.sec >= m_params.splitTime)
+		{
+			split[k] = SplitTest;
+		}
+	}
+	return split;
+}
+
+/*
+ * Greedy mining over training windows. Every base scans test windows in the
+ * same pass; they are accumulated separately and never marked scanned.
+ */
+void CandleMiner::doMineValidation(std::vector<Quotes::Ptr>& qlist)
+{
+	buildPatterns(qlist);
+	auto windows = listWindows(qlist);
+	auto split = splitWindows(qlist, windows);
+	size_t count = windows.ticker.size();
+	size_t used = count - std::count(split.begin(), split.end(), SplitNone);
+
+	Progress progress("CandleMiner validation", std::count(split.begin(), split.end(), SplitTrain));
+	std::vector<uint8_t> scanned(count, 0);
+	for(size_t b = 0; b < count; b++)
+	{
+		if(split[b] != SplitTrain)
+			continue;
+		progress.advance();
+		if(!windows.eligible[b] || scanned[b])
+			continue;
+
+		Base base;
+		base.ticker = windows.ticker[b];
+		base.pos = windows.pos[b];
+		base.pattern = pattern(m_store->offset(base.ticker) + base.pos);
+		base.quantized = quantizedRow(base.pattern);
+		for(size_t k = 0; k < count; k++)
+		{
+			if(split[k] == SplitNone)
+				continue;
+			if(matches(base, m_store->offset(windows.ticker[k]) + windows.pos[k]))
+			{
+				if(split[k] == SplitTrain)
+				{
+					addMatch(base.acc, windows.ticker[k], windows.pos[k]);
+					scanned[k] = 1;
+				}
+				else
+				{
+					addMatch(base.testAcc, windows.ticker[k], windows.pos[k]);
+				}
+			}
+		}
+		progress.addMatches((base.acc.returns.size() + base.testAcc.returns.size()) / m_params.exitHorizons.size());
+		progress.addComparisons(used);
+		m_comparisons += used;
+		m_bases.push_back(std::move(base));
+	}
+
+	updateMined(qlist);
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+void CandleMiner::spill(const Quotes::Ptr& q)
+{
+	boost::filesystem::path directory(m_params.outOfCoreDirectory);
+	boost::filesystem::create_directories(directory);
+	auto filename = (directory / (std::to_string(m_columnFiles.size()) + "-" + q->name() + ".columns")).string();
+	writeColumnFile(filename, *q, m_params.momentumOrder);
+	m_spilledFilenames.push_back(filename);
+	m_columnFiles.push_back(std::make_shared<ColumnFile>(filename));
+}
+
+/*
+ * Splits windows of column files into blocks in window order. Memory of a
+ * block is estimated per window: the candle, the normalized pattern with
+ * its signature, quantized row, momentum sign, bucket entry and excursion
+ * tables. The loaded candidate block and bases of the current base block
+ * take about the same, so each gets half of the budget. Blocks are never
+ * smaller than MinBlockWindows, as every base block loads all blocks.
+ */
+std::vector<std::vector<CandleMiner::Slice>> CandleMiner::planBlocks() const
 {
+	size_t length = m_params.patternLength;
+	size_t tableLevels = 1;
+	for(int width = 2; width <= m_params.exitAfter; width *= 2)
+		tableLevels++;
+	size_t bytesPerWindow = sizeof(Candle) + sizeof(CandlePattern) + length * sizeof(FitElement) +
+		8 * length + 1 + 1 + sizeof(uint32_t) + 2 * tableLevels * sizeof(double);
+	if(m_params.quantizedPrefilter)
+		bytesPerWindow += PatternStore::quantizedStride(length) * sizeof(int16_t);
+	size_t blockWindows = std::max<size_t>(MinBlockWindows, m_params.memoryBudget * 1024 * 1024 / (2 * bytesPerWindow));
+
+	std::vector<std::vector<Slice>> blocks(1);
+	size_t blockSize = 0;
+	for(size_t file = 0; file < m_columnFiles.size(); file++)
+	{
+		size_t windows = windowCount(m_columnFiles[file]->length());
+		for(size_t first = 0; first < windows; )
+		{
+			if(blockSize == blockWindows)
+			{
+				blocks.emplace_back();
+				blockSize = 0;
+			}
+			size_t count = std::min(windows - first, blockWindows - blockSize);
+			blocks.back().push_back(Slice { file, first, count });
+			blockSize += count;
+			first += count;
+		}
+	}
+	if(blocks.back().empty())
+		blocks.pop_back();
+	return blocks;
+}
+
+/*
+ * Makes the block current: slices are copied from column files into a
+ * pattern store, with the candles following the last window that exits
+ * need, and store tickers are slices of the block. Signatures are
+ * calculated for bases only, unless they are fitted.
+ */
+void CandleMiner::loadBlock(const std::vector<Slice>& block)
+{
+	PROFILE_SCOPE("block.load");
+	std::vector<Quotes::Ptr> slices;
+	for(const auto& slice : block)
+	{
+		slices.push_back(m_columnFiles[slice.file]->slice(slice.first,
+					slice.windows + m_params.patternLength + m_params.exitAfter));
+	}
+	m_store.reset();
+	m_store = std::make_shared<PatternStore>(slices, m_params.patternLength, m_params.fitSignatures);
+	if(m_params.quantizedPrefilter)
+		m_store->buildQuantized();
+
+	m_momentum.resize(m_store->size());
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+	for(size_t i = 0; i < block.size(); i++)
+	{
+		const auto& file = *m_columnFiles[block[i].file];
+		if(file.momentumOrder() != m_params.momentumOrder)
+			throw std::runtime_error("Column file was written with different momentum order: " + file.name());
+		const int8_t* momentum = file.momentum() + block[i].first;
+		buildColumns(*slices[i], std::vector<int8_t>(momentum, momentum + slices[i]->length()), i, block[i].windows);
+	}
+}
+
+/*
+ * Greedy grouping as in doMine() as a block nested loop: bases of one block
+ * are compared with every block in window order, so that only two blocks
+ * are held in memory. Within the base block, a window becomes a base unless
+ * an earlier base claimed it, and earlier blocks have claimed theirs
+ * already; so bases are found by comparing the base block with itself
+ * first. Its matches are kept and replayed when the block comes in turn,
+ * which keeps returns of every base in the same order as in doMine().
+ */
+void CandleMiner::doMineOutOfCore()
+{
+	std::vector<size_t> offsets;
+	size_t total = 0;
+	for(const auto& file : m_columnFiles)
+	{
+		offsets.push_back(total);
+		total += windowCount(file->length());
+	}
+	std::vector<bool> scanned(total, false);
+	auto blocks = planBlocks();
+	LOG(INFO) << "Out-of-core mining: " << total << " windows in " << blocks.size() << " blocks";
+
+	Progress progress("CandleMiner", total);
+	m_results.clear();
+	m_resultArena.clear();
+	const size_t NotLoaded = std::numeric_limits<size_t>::max();
+	size_t loaded = NotLoaded;
+	auto use = [&](size_t blockIndex) {
+		if(loaded != blockIndex)
+			loadBlock(blocks[blockIndex]);
+		loaded = blockIndex;
+	};
+
+	for(size_t baseBlock = 0; baseBlock < blocks.size(); baseBlock++)
+	{
+		const auto& block = blocks[baseBlock];
+		use(baseBlock);
+
+		std::vector<Base> bases;
+		std::vector<std::vector<std::pair<uint32_t, uint32_t>>> ownMatches;
+		size_t compared = 0;
+		for(size_t sliceIndex = 0; sliceIndex < block.size(); sliceIndex++)
+		{
+			const auto& slice = block[sliceIndex];
+			size_t length = m_columnFiles[slice.file]->length();
+			for(size_t pos = slice.first; pos < slice.first + slice.windows; pos++)
+			{
+				if(m_params.limit > 0)
+				{
+					if((double)pos / length * 100 > (size_t)m_params.limit)
+						break;
+				}
+				progress.advance();
+
+				if(scanned[offsets[slice.file] + pos])
+					continue;
+
+				Base base;
+				base.ticker = slice.file;
+				base.pos = pos;
+				base.pattern = pattern(m_store->offset(sliceIndex) + pos - slice.first);
+				if(!m_params.fitSignatures)
+					base.pattern.signature = calculateSignature(m_store->quotes()[sliceIndex], pos - slice.first, m_params.patternLength);
+				base.quantized = quantizedRow(base.pattern);
+
+				std::vector<std::pair<uint32_t, uint32_t>> matched;
+				for(size_t scanIndex = 0; scanIndex < block.size(); scanIndex++)
+				{
+					const auto& bucket = m_buckets[scanIndex][base.pattern.momentumSign];
+					compared += bucket.size();
+					for(uint32_t scanPos : bucket)
+					{
+						if(matches(base, m_store->offset(scanIndex) + scanPos))
+						{
+							matched.emplace_back(scanIndex, scanPos);
+							scanned[offsets[block[scanIndex].file] + block[scanIndex].first + scanPos] = true;
+						}
+					}
+				}
+				bases.push_back(std::move(base));
+				ownMatches.push_back(std::move(matched));
+			}
+		}
+
+		for(size_t scanBlock = 0; scanBlock < blocks.size() && !bases.empty(); scanBlock++)
+		{
+			use(scanBlock);
+			if(scanBlock == baseBlock)
+			{
+				for(size_t i = 0; i < bases.size(); i++)
+				{
+					for(const auto& m : ownMatches[i])
+						addMatch(bases[i].acc, m.first, m.second);
+				}
+				continue;
+			}
+
+			const auto& candidates = blocks[scanBlock];
+			std::vector<Base*> basePointers;
+			for(auto& base : bases)
+				basePointers.push_back(&base);
+			compared += matchTiled(basePointers, std::vector<size_t>(), [&](size_t b, size_t slice, uint32_t pos) {
+					addMatch(bases[b].acc, slice, pos);
+					scanned[offsets[candidates[slice].file] + candidates[slice].first + pos] = true;
+				});
+		}
+		progress.addComparisons(compared);
+		m_comparisons += compared;
+
+		// Results can't point into block stores, so they are copied to the arena
+		m_store.reset();
+		loaded = NotLoaded;
+		for(const auto& base : bases)
+		{
+			progress.addMatches(base.acc.returns.size() / m_params.exitHorizons.size());
+			Result r;
+			if(makeResult(base, r))
+				m_results.push_back(r);
+		}
+	}
+
+	m_momentum.clear();
+	m_momentum.shrink_to_fit();
+	m_buckets.clear();
+	m_lows.clear();
+	m_highs.clear();
+}
+
+void CandleMiner::makeResults()
+{
+	m_results.clear();
+	m_resultArena.clear();
+	for(const auto& base : m_bases)
+	{
+		Result r;
+		if(makeResult(base, r))
+			m_results.push_back(r);
+	}
+	finishResults();
+}
+
+/*
+ * Statistics over the whole set of results
+ */
+void CandleMiner::finishResults()
+{
+	calculatePValues();
+	if(m_params.resamples > 0)
+		calculateBootstrapPValues(nullPopulations());
+}
+
+/*
+ * Significance of all results in one batch: exit statistics of every
+ * horizon, in-sample and out-of-sample, are laid out as columns
+ */
+void CandleMiner::calculatePValues()
+{
+	size_t horizons = m_params.exitHorizons.size();
+	std::vector<ExitStats*> exits;
+	std::vector<int> counts, posReturns;
+	std::vector<double> means, sigmas;
+	for(auto& r : m_results)
+	{
+		for(size_t h = 0; h < horizons; h++)
+		{
+			exits.push_back(&r.exits[h]);
+			counts.push_back(r.count);
+		}
+		for(size_t h = 0; r.testExits && (h < horizons); h++)
+		{
+			exits.push_back(&r.testExits[h]);
+			counts.push_back(r.testCount);
+		}
+	}
+	for(const auto e : exits)
+	{
+		posReturns.push_back(e->pos_returns);
+		means.push_back(e->mean);
+		sigmas.push_back(e->sigma);
+	}
+
+	std::vector<double> p(exits.size()), meanP(exits.size());
+	binomialPValues(counts.data(), posReturns.data(), exits.size(), p.data());
+	meanPValues(counts.data(), means.data(), sigmas.data(), exits.size(), meanP.data());
+	for(size_t i = 0; i < exits.size(); i++)
+	{
+		exits[i]->p = p[i];
+		exits[i]->mean_p = meanP[i];
+	}
+}
+
+/*
+ * Population of each horizon is the returns of all scan windows, which
+ * every pattern's matches are drawn from
+ */
+std::vector<std::vector<double>> CandleMiner::nullPopulations() const
+{
+	const auto& horizons = m_params.exitHorizons;
+	std::vector<std::vector<double>> populations(horizons.size());
+	if(m_columnFiles.empty())
+	{
+		for(size_t h = 0; h < horizons.size(); h++)
+		{
+			for(const auto& q : m_store->quotes())
+			{
+				for(size_t pos = 0; pos < windowCount(q); pos++)
+				{
+					size_t nextPos = pos + m_params.patternLength;
+					double entry = q->at(nextPos).open;
+					populations[h].push_back((q->at(nextPos + horizons[h] - 1).close - entry) / entry);
+				}
+			}
+		}
+		return populations;
+	}
 
-	SignatureElement(double p, char type, int index) : price(p), sign(type + std::to_string(index))
+	// Out-of-core populations are limited to the memory budget: column files
+	// are read through once, and a reservoir sample of windows stands in for
+	// all of them if they don't fit. The sample follows the resampling seed.
+	size_t capacity = std::max<size_t>(1, m_params.memoryBudget * 1024 * 1024 / (sizeof(double) * horizons.size()));
+	std::mt19937_64 rng(m_params.resamplingSeed);
+	size_t seen = 0;
+	for(const auto& file : m_columnFiles)
 	{
+		for(size_t pos = 0; pos < windowCount(file->length()); pos++, seen++)
+		{
+			size_t slot = seen < capacity ? seen : rng() % (seen + 1);
+			if(slot >= capacity)
+				continue;
+			size_t nextPos = pos + m_params.patternLength;
+			double entry = file->open()[nextPos];
+			for(size_t h = 0; h < horizons.size(); h++)
+			{
+				double ret = (file->close()[nextPos + horizons[h] - 1] - entry) / entry;
+				if(slot == populations[h].size())
+					populations[h].push_back(ret);
+				else
+					populations[h][slot] = ret;
+			}
+		}
 	}
+	if(seen > capacity)
+		LOG(INFO) << "Bootstrap population: " << capacity << " of " << seen << " windows sampled to fit memory budget";
+	return populations;
+}
 
-	double price;
-	std::string sign;
-};
+void CandleMiner::calculateBootstrapPValues(const std::vector<std::vector<double>>& populations)
+{
+	const auto& horizons = m_params.exitHorizons;
+	std::vector<int> counts;
+	for(const auto& r : m_results)
+		counts.push_back(r.count);
+
+	double filterQ = m_reportConfig.get("filter-q", 0).asDouble();
+	double floorQ = std::min(1.0, (double)m_results.size() / (m_params.resamples + 1));
+	if((filterQ > 0) && (floorQ > filterQ))
+		LOG(WARNING) << "Bootstrap resamples can't give q-values below " << floorQ << " for " << m_results.size() <<
+			" patterns, so filter-q passes none of them. Use at least " <<
+			(size_t)std::ceil(m_results.size() / filterQ) << " resamples";
+
+	for(size_t h = 0; h < horizons.size(); h++)
+	{
+		std::vector<double> means;
+		for(const auto& r : m_results)
+			means.push_back(r.exits[h].mean);
+		auto p = bootstrapMeanPValues(populations[h], counts, means, m_params.resamples, m_params.resamplingSeed + h, threadCount());
+		auto q = benjaminiHochberg(p);
+		for(size_t i = 0; i < m_results.size(); i++)
+		{
+			m_results[i].exits[h].bootstrap_p = p[i];
+			m_results[i].exits[h].q = q[i];
+		}
+	}
+}
 
-static CandleMiner::Pattern convertToRelativeUnits(Quotes& q, size_t startPos, int patternLength, int momentumOrder)
+static CandleMiner::ExitStats calculateExitStats(const std::vector<double>& returns, double min_low, double max_high)
 {
-	auto startPrice = q[startPos].open;
-	double startVolume = q[startPos].volume;
-	CandleMiner::Pattern pattern;
-	std::vector<double> signatureArray;
-	for(int i = 0; i < patternLength; i++)
+	CandleMiner::ExitStats e;
+	int counter = returns.size();
+
+	double mean = 0;
+	double min_return = 1.0;
+	double max_return = -1.0;
+	double mean_pos = 0;
+	double mean_neg = 0;
+	int pos_returns = 0;
+	int neg_returns = 0;
+	for(double this_return : returns)
 	{
-		FitElement el;
-		el.open = q[startPos + i].open / startPrice;
-		el.high = q[startPos + i].high / startPrice;
-		el.low = q[startPos + i].low / startPrice;
-		el.close = q[startPos + i].close / startPrice;
-		el.volume = (double)q[startPos + i].volume / startVolume;
-		pattern.elements.push_back(el);
+		if(this_return > max_return)
+			max_return = this_return;
+		if(this_return < min_return)
+			min_return = this_return;
+		if(this_return > 0)
+		{
+			mean_pos += this_return;
+			pos_returns++;
+		}
+		if(this_return <= 0)
+		{
+			mean_neg += this_return;
+			neg_returns++;
+		}
+		mean += this_return;
 	}
 
-	if(momentumOrder > 0)
+	if(pos_returns > 0)
 	{
-		if((int)startPos - momentumOrder < 0)
-			pattern.momentumSign = 0;
-		else
-			pattern.momentumSign = q[startPos - momentumOrder].close - q[startPos].open > 0 ? 1 : -1;
+		mean_pos /= pos_returns;
+	}
+	if(neg_returns > 0)
+	{
+		mean_neg /= neg_returns;
+	}
+
+	mean /= counter;
+	double sigma = 0;
+	for(double r : returns)
+	{
+		sigma += (r - mean) * (r - mean);
+	}
+	if(counter > 2)
+		sigma /= (counter - 1);
+	else
+		sigma = 0;
+	sigma = sqrt(sigma);
+
+
+	// p and mean_p are filled by calculatePValues() over all results
+	e.mean = mean;
+	e.sigma = sigma;
+	e.pos_returns = pos_returns;
+	e.p = 1;
+	e.mean_p = 1;
+	e.min_return = min_return;
+	e.max_return = max_return;
+	e.min_low = min_low;
+	e.max_high = max_high;
+	e.mean_pos = mean_pos;
+	e.mean_neg = mean_neg;
+	e.bootstrap_p = 1;
+	e.q = 1;
+	if((counter % 2) == 0)
+	{
+		e.median = 0.5 * (returns[counter / 2 - 1] + returns[counter / 2]);
 	}
 	else
 	{
-		pattern.momentumSign = 0;
+		e.median = returns[counter / 2];
 	}
-	return pattern;
+	return e;
 }
 
-bool CandleMiner::fit(const Pattern& f1, const Pattern& f2, int length)
+bool CandleMiner::makeResult(const Base& base, Result& r)
 {
-	if(f1.momentumSign != f2.momentumSign)
+	PROFILE_SCOPE("statistics");
+	size_t horizons = m_params.exitHorizons.size();
+	int counter = base.acc.returns.size() / horizons;
+	if(counter <= 1)
 		return false;
 
-	double abs_min = 10000000;
-	double abs_max = -10000000;
-	for(int i = 0; i < length; i++)
+	r.momentumSign = base.pattern.momentumSign;
+	if(m_store)
 	{
-		abs_min = std::min(abs_min, std::min(f1.elements[i].low, f2.elements[i].low));
-		abs_max = std::max(abs_max, std::max(f1.elements[i].high, f2.elements[i].high));
+		const auto& p = (*m_store)[m_store->offset(base.ticker) + base.pos];
+		r.elements = p.elements.data();
+		r.signature = p.signature.c_str();
 	}
-	double tolerance = (abs_max - abs_min) * m_params.candleFit;
-	for(int i = 0; i < length; i++)
+	else
 	{
-		if(fabs(f1.elements[i].open - f2.elements[i].open) > tolerance)
-			return false;
-		if(fabs(f1.elements[i].close - f2.elements[i].close) > tolerance)
-			return false;
-		if(fabs(f1.elements[i].high - f2.elements[i].high) > tolerance)
-			return false;
-		if(fabs(f1.elements[i].low - f2.elements[i].low) > tolerance)
-			return false;
-		if((f1.elements[i].open - f1.elements[i].close) * (f2.elements[i].open - f2.elements[i].close) < 0)
-			return false;
-		if(m_params.fitSignatures)
-		{
-			if(f1.signature != f2.signature)
-				return false;
-		}
-		if(m_params.volumeFit > 0)
+		r.elements = m_resultArena.copy(base.pattern.elements.data(), base.pattern.elements.size());
+		r.signature = m_resultArena.copy(base.pattern.signature);
+	}
+	r.count = counter;
+	r.exits = exitStats(base.acc);
+	r.testCount = base.testAcc.returns.size() / horizons;
+	r.testExits = nullptr;
+	if(r.testCount > 1)
+		r.testExits = exitStats(base.testAcc);
+	return true;
+}
+
+CandleMiner::ExitStats* CandleMiner::exitStats(const Accumulator& acc)
+{
+	size_t horizons = m_params.exitHorizons.size();
+	size_t counter = acc.returns.size() / horizons;
+	ExitStats* exits = m_resultArena.allocate<ExitStats>(horizons);
+	std::vector<double> returns(counter);
+	for(size_t h = 0; h < horizons; h++)
+	{
+		for(size_t i = 0; i < counter; i++)
 		{
-			if(fabs(f1.elements[i].volume - f2.elements[i].volume) > m_params.volumeFit)
-				return false;
+			returns[i] = acc.returns[i * horizons + h];
 		}
+		exits[h] = calculateExitStats(returns, acc.min_low[h], acc.max_high[h]);
+		exits[h].exitAfter = m_params.exitHorizons[h];
 	}
-	return true;
+	return exits;
 }
 
-static std::string calculateSignature(const Quotes::Ptr& q, size_t pos, int patternLength)
+std::vector<Quotes::Ptr> CandleMiner::orderQuotes(const std::vector<Quotes::Ptr>& quotes)
 {
-	std::string signature;
+	std::vector<Quotes::Ptr> result;
+	std::vector<bool> used(quotes.size(), false);
+	for(const auto& mined : m_mined)
+	{
+		bool found = false;
+		for(size_t i = 0; i < quotes.size(); i++)
+		{
+			if(!used[i] && quotes[i]->name() == mined.name)
+			{
+				if((quotes[i]->length() < mined.candles) ||
+						(mined.candles > 0 && quotes[i]->at(mined.candles - 1).time.sec != mined.lastTime))
+					throw std::runtime_error("Quotes for " + mined.name + " do not extend previously mined data");
+				result.push_back(quotes[i]);
+				used[i] = true;
+				found = true;
+				break;
+			}
+		}
+		if(!found)
+			throw std::runtime_error("Previously mined ticker is missing: " + mined.name);
+	}
 
-	std::vector<SignatureElement> els;
-	els.reserve(4 * patternLength);
-	for(int i = 0; i < patternLength; i++)
+	for(size_t i = 0; i < quotes.size(); i++)
 	{
-		els.emplace_back(q->at(pos + i).open, 'O', i);
-		els.emplace_back(q->at(pos + i).high, 'H', i);
-		els.emplace_back(q->at(pos + i).low, 'L', i);
-		els.emplace_back(q->at(pos + i).close, 'C', i);
+		if(!used[i])
+			result.push_back(quotes[i]);
 	}
+	return result;
+}
 
-	std::sort(els.begin(), els.end(), [](const SignatureElement& e1, const SignatureElement& e2)
-			{
-				if(e1.price != e2.price)
-					return e1.price < e2.price;
-				else
-					return e1.sign < e2.sign;
-			});
+void CandleMiner::parseConfig(const Json::Value& root)
+{
+	auto minerRoot = root["miner"];
+	m_params.candleFit = root.get("candle-fit-tolerance", 0.1).asDouble();
+	m_params.volumeFit = root.get("volume-fit-tolerance", 0).asDouble();
+	m_params.patternLength = root.get("pattern-length", 2).asUInt();
+	selectKernels();
+	m_params.limit = root.get("sample-percentage", -1).asDouble();
+	m_params.exitHorizons.clear();
+	auto exitAfter = root.get("exit-after", 2);
+	if(exitAfter.isArray())
+	{
+		for(const auto& e : exitAfter)
+			m_params.exitHorizons.push_back(e.asUInt());
+	}
+	else
+	{
+		m_params.exitHorizons.push_back(exitAfter.asUInt());
+	}
+	normalizeExitHorizons();
+	m_params.momentumOrder = root.get("momentum-order", -1).asInt();
+	m_params.fitSignatures = root.get("fit-signatures", false).asBool();
+	m_params.quantizedPrefilter = root.get("quantized-prefilter", false).asBool();
+	auto grouping = root.get("grouping", "greedy").asString();
+	if(grouping == "greedy")
+		m_params.grouping = GroupingGreedy;
+	else if(grouping == "match-graph")
+		m_params.grouping = GroupingMatchGraph;
+	else if(grouping == "clusters")
+		m_params.grouping = GroupingClusters;
+	else
+		throw std::runtime_error("Unknown grouping: " + grouping);
+	m_params.threads = root.get("threads", 0).asInt();
 
+	auto resampling = root["resampling"];
+	m_params.resamples = resampling.get("resamples", resampling.isNull() ? 0 : 1000).asInt();
+	m_params.resamplingSeed = resampling.get("seed", 1).asUInt64();
 
-	for(const auto& se : els)
+	auto validation = root["validation"];
+	m_params.validation = !validation.isNull();
+	if(m_params.validation)
 	{
-		signature += se.sign;
+		for(const auto& ticker : validation["test-tickers"])
+			m_params.testTickers.push_back(ticker.asString());
+		auto splitDate = validation.get("split-date", "").asString();
+		if(m_params.testTickers.empty() == splitDate.empty())
+			throw std::runtime_error("Validation needs either split-date or test-tickers");
+		if(!splitDate.empty())
+			m_params.splitTime = parseTime(splitDate, validation.get("split-time", "000000").asString()).sec;
 	}
+	m_params.stateFilename = root.get("incremental-state", "").asString();
+	int stateMaxMatches = root.get("incremental-state-max-matches", 0).asInt();
+	if(stateMaxMatches < 0)
+		throw std::runtime_error("Incremental state max matches should not be negative");
+	m_params.stateMaxMatches = stateMaxMatches;
+
+	auto outOfCore = root["out-of-core"];
+	m_params.outOfCoreDirectory = outOfCore.get("directory", "").asString();
+	m_params.memoryBudget = outOfCore.get("memory-budget", 1024).asDouble();
+	if(!outOfCore.isNull() && m_params.outOfCoreDirectory.empty())
+		throw std::runtime_error("Out-of-core mode needs a directory for column files");
+	if(!(m_params.memoryBudget > 0))
+		throw std::runtime_error("Out-of-core memory budget should be positive");
+	if(!m_params.outOfCoreDirectory.empty() &&
+			(!m_params.stateFilename.empty() || (m_params.grouping != GroupingGreedy) || m_params.validation))
+		throw std::runtime_error("Out-of-core mining supports greedy grouping without validation or incremental state only");
 
-	return signature;
+	auto reportConfig = root["report"];
+	m_reportConfig.swap(reportConfig);
 }
 
-static std::vector<std::string> calculateSignatures(std::vector<Quotes::Ptr>& qlist, int patternLength)
+void CandleMiner::setQuotes(const std::vector<Quotes::Ptr>& quotes)
 {
-	std::vector<std::string> result;
+	m_quotes = quotes;
+}
 
-	size_t baseIndex = 0;
-	for(const auto& q : qlist)
+void CandleMiner::mine()
+{
+	PROFILE_SCOPE("mine");
+	m_mined.clear();
+	m_bases.clear();
+	m_scan.scanned.clear();
+	if(!m_params.outOfCoreDirectory.empty())
 	{
-		for(size_t index = 0; index < q->length() - patternLength; index++)
+		if((m_shardCount > 0) || !m_params.stateFilename.empty() || !m_checkpointFilename.empty() ||
+				(m_params.grouping != GroupingGreedy) || m_params.validation)
+			throw std::runtime_error("Out-of-core mining supports greedy grouping without shards, validation, incremental state or checkpoints only");
+		if(m_columnFiles.empty())
 		{
-			result.push_back(calculateSignature(q, index, patternLength));
+			for(const auto& q : m_quotes)
+				spill(q);
 		}
-		baseIndex++;
+		doMineOutOfCore();
+		finishResults();
+		return;
 	}
 
-	return result;
-}
+	if(m_shardCount > 0)
+	{
+		if(!m_params.stateFilename.empty() || !m_checkpointFilename.empty())
+			throw std::runtime_error("Sharded mining can't be combined with incremental state or checkpoints");
+		if((m_params.grouping != GroupingGreedy) || m_params.validation)
+			throw std::runtime_error("Sharded mining supports greedy grouping without validation only");
+		auto qlist = orderQuotes(m_quotes);
+		doMineShard(qlist);
+		return;
+	}
 
-CandleMiner::CandleMiner()
-{
+	if(m_params.validation)
+	{
+		if(!m_params.stateFilename.empty() || !m_checkpointFilename.empty() || (m_params.grouping != GroupingGreedy))
+			throw std::runtime_error("Validation mode can't be combined with incremental state, checkpoints or non-greedy grouping");
+		auto qlist = orderQuotes(m_quotes);
+		doMineValidation(qlist);
+		makeResults();
+		m_bases.clear();
+		return;
+	}
 
+	if(m_params.grouping != GroupingGreedy)
+	{
+		if(!m_params.stateFilename.empty() || !m_checkpointFilename.empty())
+			throw std::runtime_error("Match graph and cluster grouping can't be combined with incremental state or checkpoints");
+		auto qlist = orderQuotes(m_quotes);
+		if(m_params.grouping == GroupingMatchGraph)
+			doMineGraph(qlist);
+		else
+			doMineClusters(qlist);
+		makeResults();
+		m_bases.clear();
+		return;
+	}
+
+	std::vector<std::pair<std::string, size_t>> checkpointQuotes;
+	if(m_resume && boost::filesystem::exists(m_checkpointFilename))
+	{
+		checkpointQuotes = loadCheckpoint(m_checkpointFilename);
+		LOG(INFO) << "Resuming from checkpoint: " << m_bases.size() << " base patterns done";
+	}
+	else if(!m_params.stateFilename.empty() && boost::filesystem::exists(m_params.stateFilename))
+	{
+		loadState(m_params.stateFilename);
+		LOG(INFO) << "Loaded incremental state: " << m_bases.size() << " base patterns over " << m_mined.size() << " tickers";
+	}
+
+	auto qlist = orderQuotes(m_quotes);
+	if(!checkpointQuotes.empty())
+	{
+		if(checkpointQuotes.size() != qlist.size())
+			throw std::runtime_error("Checkpoint does not match loaded quotes");
+		for(size_t i = 0; i < qlist.size(); i++)
+		{
+			if((checkpointQuotes[i].first != qlist[i]->name()) || (checkpointQuotes[i].second != qlist[i]->length()))
+				throw std::runtime_error("Checkpoint does not match loaded quotes: " + qlist[i]->name());
+		}
+	}
+	doMine(qlist);
+
+	if(!m_params.stateFilename.empty())
+		saveState(m_params.stateFilename);
+
+	finishResults();
+
+	if(m_params.stateFilename.empty())
+		m_bases.clear();
 }
 
-CandleMiner::CandleMiner(const Params& p) : m_params(p)
+static const uint32_t StateMagic = 0x53434d50; // "PMCS"
+static const uint32_t CheckpointMagic = 0x4b434d50; // "PMCK"
+static const uint32_t ShardMagic = 0x48534d50; // "PMSH"
+static const uint32_t StateVersion = 4;
+
+void CandleMiner::saveState(const std::string& filename)
 {
-	assert(m_params.patternLength < MaxPatternLength);
+	BinaryWriter out(filename);
+	out.write(StateMagic);
+	out.write(StateVersion);
+	writeState(out, m_params.stateMaxMatches);
+	out.commit();
 }
 
-CandleMiner::~CandleMiner()
+void CandleMiner::loadState(const std::string& filename)
 {
+	BinaryReader in(filename);
+	if(in.read<uint32_t>() != StateMagic)
+		throw std::runtime_error("Not an incremental state file: " + filename);
+	if(in.read<uint32_t>() != StateVersion)
+		throw std::runtime_error("Unsupported incremental state version: " + filename);
+	readState(in, filename);
 }
 
-std::vector<CandleMiner::Result> CandleMiner::doMine(std::vector<Quotes::Ptr>& qlist)
+void CandleMiner::saveShard(const std::string& filename)
 {
-	std::vector<std::string> signatures = calculateSignatures(qlist, m_params.patternLength);
-	std::vector<Result> result;
-	int total_positions = 0;
-	for(const auto& q : qlist)
+	BinaryWriter out(filename);
+	out.write(ShardMagic);
+	out.write(StateVersion);
+	out.write<int32_t>(m_shardIndex);
+	out.write<int32_t>(m_shardCount);
+	writeState(out, 0);
+	for(const auto& base : m_bases)
 	{
-		total_positions += q->length();
+		out.writeVector(base.matches);
 	}
-	std::vector<int> scanned(total_positions, 0);
-	int baseIndex = 0;
-	for(const auto& qbase : qlist)
+	// Bootstrap needs returns of all windows, and merge has no quotes. Every
+	// shard has the same windows, so only the first one stores them
+	std::vector<std::vector<double>> populations;
+	if((m_params.resamples > 0) && (m_shardIndex == 0))
+		populations = nullPopulations();
+	out.write<uint64_t>(populations.size());
+	for(const auto& population : populations)
 	{
-		int last_percent = 0;
-		for(size_t pos = 0; pos < qbase->length() - m_params.patternLength - m_params.exitAfter; pos++)
-		{
-			if(m_params.limit > 0)
-			{
-				if((double)pos / qbase->length() * 100 > (size_t)m_params.limit)
-					break;
-			}
+		out.writeVector(population);
+	}
+	out.commit();
+}
 
-			if(scanned[baseIndex + pos])
-				continue;
+void CandleMiner::mergeShards(const std::vector<std::string>& filenames)
+{
+	std::vector<Base> bases;
+	std::vector<MinedTicker> mined;
+	std::vector<bool> seenShards;
+	std::vector<std::vector<double>> populations;
+	for(const auto& filename : filenames)
+	{
+		BinaryReader in(filename);
+		if(in.read<uint32_t>() != ShardMagic)
+			throw std::runtime_error("Not a shard file: " + filename);
+		if(in.read<uint32_t>() != StateVersion)
+			throw std::runtime_error("Unsupported shard file version: " + filename);
+		int shardIndex = in.read<int32_t>();
+		int shardCount = in.read<int32_t>();
+		if(seenShards.empty())
+			seenShards.resize(shardCount, false);
+		if((shardCount != (int)seenShards.size()) || (shardIndex < 0) || (shardIndex >= shardCount))
+			throw std::runtime_error("Shard count mismatch: " + filename);
+		if(seenShards[shardIndex])
+			throw std::runtime_error("Duplicate shard: " + filename);
+		seenShards[shardIndex] = true;
 
-			int current_percent = (double)pos / qbase->length() * 10000;
-			if(current_percent != last_percent)
-			{
-				LOG(DEBUG) << qbase->name() << ": " << (double)current_percent / 100 << "% done";
-				last_percent = current_percent;
-			}
-			size_t startPos = pos;
-			Pattern basePattern = convertToRelativeUnits(*qbase, startPos, m_params.patternLength, m_params.momentumOrder);
-			basePattern.signature = signatures[baseIndex + pos];
-
-			double mean = 0;
-			int counter = 0;
-			double min_return = 1.0;
-			double max_return = -1.0;
-			double min_low = 1.0;
-			double max_high = -1.0;
-			double mean_pos = 0;
-			double mean_neg = 0;
-			int pos_returns = 0;
-			int neg_returns = 0;
-			std::vector<double> returns;
-
-			int scanIndex = 0;
-			for(const auto& qscan : qlist)
-			{
-				for(size_t scanPos = 0; scanPos < qscan->length() - m_params.patternLength - m_params.exitAfter; scanPos++)
-				{
-					Pattern thisPattern = convertToRelativeUnits(*qscan, scanPos, m_params.patternLength, m_params.momentumOrder);
-					thisPattern.signature = signatures[scanIndex + scanPos];
-					if(fit(basePattern, thisPattern, m_params.patternLength))
-					{
-						size_t nextPos = scanPos + m_params.patternLength;
-						size_t exitPos = scanPos + m_params.patternLength + m_params.exitAfter - 1;
-						double this_return = (qscan->at(exitPos).close - qscan->at(nextPos).open) / qscan->at(nextPos).open;
-						double this_low = (qscan->at(nextPos).low - qscan->at(nextPos).open) / qscan->at(nextPos).open;
-						double this_high = (qscan->at(nextPos).high - qscan->at(nextPos).open) / qscan->at(nextPos).open;
-						for(int offset = 0; offset < m_params.exitAfter; offset++)
-						{
-							this_low = std::min(this_low, (qscan->at(nextPos + offset).low - qscan->at(nextPos).open) / qscan->at(nextPos).open);
-							this_high = std::max(this_high, (qscan->at(nextPos + offset).high - qscan->at(nextPos).open) / qscan->at(nextPos).open);
-						}
+		readState(in, filename);
+		for(auto& base : m_bases)
+		{
+			base.matches = in.readVector<uint32_t>();
+		}
+		std::vector<std::vector<double>> shardPopulations(in.readCount(sizeof(uint64_t)));
+		for(auto& population : shardPopulations)
+		{
+			population = in.readVector<double>();
+		}
+		if(shardIndex == 0)
+		{
+			if((m_params.resamples > 0) && shardPopulations.empty())
+				throw std::runtime_error("Shard was mined without resampling: " + filename);
+			populations.swap(shardPopulations);
+		}
 
-						if(this_return > max_return)
-							max_return = this_return;
-						if(this_return < min_return)
-							min_return = this_return;
-						min_low = std::min(min_low, this_low);
-						max_high = std::max(max_high, this_high);
-						if(this_return > 0)
-						{
-							mean_pos += this_return;
-							pos_returns++;
-						}
-						if(this_return <= 0)
-						{
-							mean_neg += this_return;
-							neg_returns++;
-						}
-						mean += this_return;
-						returns.push_back(this_return);
-						counter++;
-						scanned[scanIndex + scanPos] = 1;
-					}
-				}
-				scanIndex += qscan->length();
-			}
-			if(pos_returns > 0)
-			{
-				mean_pos /= pos_returns;
-			}
-			if(neg_returns > 0)
+		if(mined.empty())
+		{
+			mined = m_mined;
+		}
+		else
+		{
+			bool same = mined.size() == m_mined.size();
+			for(size_t i = 0; same && (i < mined.size()); i++)
 			{
-				mean_neg /= neg_returns;
+				same = (mined[i].name == m_mined[i].name) && (mined[i].candles == m_mined[i].candles) &&
+					(mined[i].lastTime == m_mined[i].lastTime);
 			}
-			if(counter > 1)
-			{
-				mean /= counter;
-				double sigma = 0;
-				double binomial_sigma = sqrt(counter);
-				for(double r : returns)
-				{
-					sigma += (r - mean) * (r - mean);
-				}
-				if(counter > 2)
-					sigma /= (counter - 1);
-				else
-					sigma = 0;
-				sigma = sqrt(sigma);
-
-
-				double q = fabs(pos_returns - (double)counter / 2) / binomial_sigma;
-				double p = (1 - erf(q));
+			if(!same)
+				throw std::runtime_error("Shard was mined over different quotes: " + filename);
+		}
+		std::move(m_bases.begin(), m_bases.end(), std::back_inserter(bases));
+		m_bases.clear();
+	}
 
-				Result r;
-				r.signature = basePattern.signature;
-				r.momentumSign = basePattern.momentumSign;
-				r.elements = basePattern.elements;
+	if(std::find(seenShards.begin(), seenShards.end(), false) != seenShards.end())
+		throw std::runtime_error("Not all shards are given");
 
-				students_t dist(counter - 1);
+	// Window ids are numbered as in PatternStore
+	std::vector<size_t> offsets;
+	size_t total = 0;
+	for(const auto& m : mined)
+	{
+		offsets.push_back(total);
+		if(m.candles > (size_t)m_params.patternLength)
+			total += m.candles - m_params.patternLength;
+	}
 
-				double students_factor = sigma / sqrt(counter);
-				r.mean_p  = 1;
-				for(auto a : alpha)
-				{
-					double T = quantile(complement(dist, a / 2));
-					if((mean > 0) && (mean - T * students_factor > 0))
-					{
-						r.mean_p = a;
-						break;
-					}
+	std::sort(bases.begin(), bases.end(), [&](const Base& b1, const Base& b2) {
+			return offsets[b1.ticker] + b1.pos < offsets[b2.ticker] + b2.pos;
+			});
 
-					if((mean < 0) && (mean + T * students_factor < 0))
-					{
-						r.mean_p = a;
-						break;
-					}
-				}
-				r.mean = mean;
-				r.sigma = sigma;
-				r.count = counter;
-				r.pos_returns = pos_returns;
-				r.p = p;
-				r.min_return = min_return;
-				r.max_return = max_return;
-				r.min_low = min_low;
-				r.max_high = max_high;
-				r.mean_pos = mean_pos;
-				r.mean_neg = mean_neg;
-				if((counter % 2) == 0)
-				{
-					r.median = 0.5 * (returns[counter / 2 - 1] + returns[counter / 2]);
-				}
-				else
-				{
-					r.median = returns[counter / 2];
-				}
-				result.push_back(r);
-			}
+	std::vector<uint8_t> scanned(total, 0);
+	m_results.clear();
+	m_resultArena.clear();
+	for(const auto& base : bases)
+	{
+		if(scanned[offsets[base.ticker] + base.pos])
+			continue;
+		for(auto id : base.matches)
+		{
+			scanned[id] = 1;
 		}
-		baseIndex += qbase->length();
+		Result r;
+		if(makeResult(base, r))
+			m_results.push_back(r);
 	}
-	return result;
+	calculatePValues();
+	if(m_params.resamples > 0)
+		calculateBootstrapPValues(populations);
+	m_mined = mined;
+	LOG(INFO) << "Merged " << filenames.size() << " shards: " << m_results.size() << " patterns";
 }
 
+/*
+ * Every checkpoint rewrites all bases with their returns, so it takes about
+ * as long as writing 8 bytes per match and horizon plus a byte per window:
+ * 35 ms for 60000 windows (11 MB), well below 1% of the default interval.
+ */
+void CandleMiner::saveCheckpoint(const std::vector<Quotes::Ptr>& qlist)
+{
+	BinaryWriter out(m_checkpointFilename);
+	out.write(CheckpointMagic);
+	out.write(StateVersion);
+	writeState(out, 0);
 
-void CandleMiner::parseConfig(const Json::Value& root)
+	out.write<uint64_t>(qlist.size());
+	for(const auto& q : qlist)
+	{
+		out.writeString(q->name());
+		out.write<uint64_t>(q->length());
+	}
+	out.write<uint64_t>(m_scan.ticker);
+	out.write<uint64_t>(m_scan.pos);
+	out.writeVector(m_scan.scanned);
+	out.commit();
+	LOG(DEBUG) << "Checkpoint saved at " << m_scan.ticker << ":" << m_scan.pos;
+}
+
+std::vector<std::pair<std::string, size_t>> CandleMiner::loadCheckpoint(const std::string& filename)
 {
-	auto minerRoot = root["miner"];
-	m_params.candleFit = root.get("candle-fit-tolerance", 0.1).asDouble();
-	m_params.volumeFit = root.get("volume-fit-tolerance", 0).asDouble();
-	m_params.patternLength = root.get("pattern-length", 2).asUInt();
-	m_params.limit = root.get("sample-percentage", -1).asDouble();
-	m_params.exitAfter = root.get("exit-after", 2).asUInt();
-	m_params.momentumOrder = root.get("momentum-order", -1).asInt();
-	m_params.fitSignatures = root.get("fit-signatures", false).asBool();
+	BinaryReader in(filename);
+	if(in.read<uint32_t>() != CheckpointMagic)
+		throw std::runtime_error("Not a checkpoint file: " + filename);
+	if(in.read<uint32_t>() != StateVersion)
+		throw std::runtime_error("Unsupported checkpoint version: " + filename);
+	readState(in, filename);
 
-	auto reportConfig = root["report"];
-	m_reportConfig.swap(reportConfig);
+	std::vector<std::pair<std::string, size_t>> quotes(in.readCount(2 * sizeof(uint64_t)));
+	for(auto& q : quotes)
+	{
+		q.first = in.readString();
+		q.second = in.read<uint64_t>();
+	}
+	m_scan.ticker = in.read<uint64_t>();
+	m_scan.pos = in.read<uint64_t>();
+	m_scan.scanned = in.readVector<uint8_t>();
+	return quotes;
 }
 
-void CandleMiner::setQuotes(const std::vector<Quotes::Ptr>& quotes)
+/*
+ * Bases with more than maxMatches matches keep returns of the latest ones,
+ * 0 writes them all
+ */
+void CandleMiner::writeState(BinaryWriter& out, size_t maxMatches)
 {
-	m_quotes = quotes;
+	out.write<int32_t>(m_params.patternLength);
+	out.writeVector(m_params.exitHorizons);
+	out.write<int32_t>(m_params.momentumOrder);
+	out.write<uint8_t>(m_params.fitSignatures);
+	out.write(m_params.candleFit);
+	out.write(m_params.volumeFit);
+	out.write(m_params.limit);
+
+	out.write<uint64_t>(m_mined.size());
+	for(const auto& mined : m_mined)
+	{
+		out.writeString(mined.name);
+		out.write<uint64_t>(mined.candles);
+		out.write<uint64_t>(mined.windows);
+		out.write<int64_t>(mined.lastTime);
+	}
+
+	out.write<uint64_t>(m_bases.size());
+	for(const auto& base : m_bases)
+	{
+		out.write<int32_t>(base.ticker);
+		out.write<uint64_t>(base.pos);
+		out.write<int32_t>(base.pattern.momentumSign);
+		out.writeVector(base.pattern.elements);
+		out.writeString(base.pattern.signature);
+		out.writeVector(base.acc.min_low);
+		out.writeVector(base.acc.max_high);
+		size_t keep = std::min(base.acc.returns.size(), maxMatches * m_params.exitHorizons.size());
+		if(maxMatches == 0)
+			keep = base.acc.returns.size();
+		out.write<uint64_t>(keep);
+		out.writeRaw(base.acc.returns.data() + base.acc.returns.size() - keep, keep * sizeof(double));
+	}
 }
 
-void CandleMiner::mine()
+void CandleMiner::readState(BinaryReader& in, const std::string& filename)
 {
-	m_results = doMine(m_quotes);
+	bool compatible = true;
+	compatible &= in.read<int32_t>() == m_params.patternLength;
+	compatible &= in.readVector<int>() == m_params.exitHorizons;
+	compatible &= in.read<int32_t>() == m_params.momentumOrder;
+	compatible &= (bool)in.read<uint8_t>() == m_params.fitSignatures;
+	compatible &= in.read<double>() == m_params.candleFit;
+	compatible &= in.read<double>() == m_params.volumeFit;
+	compatible &= in.read<double>() == m_params.limit;
+	if(!compatible)
+		throw std::runtime_error("State was created with different miner parameters: " + filename);
+
+	m_mined.resize(in.readCount(4 * sizeof(uint64_t)));
+	for(auto& mined : m_mined)
+	{
+		mined.name = in.readString();
+		mined.candles = in.read<uint64_t>();
+		mined.windows = in.read<uint64_t>();
+		mined.lastTime = in.read<int64_t>();
+	}
+
+	m_bases.resize(in.readCount(5 * sizeof(uint64_t)));
+	for(auto& base : m_bases)
+	{
+		base.ticker = in.read<int32_t>();
+		base.pos = in.read<uint64_t>();
+		base.pattern.momentumSign = in.read<int32_t>();
+		base.pattern.elements = in.readVector<FitElement>();
+		calculateRange(base.pattern);
+		base.pattern.signature = in.readString();
+		base.acc.min_low = in.readVector<double>();
+		base.acc.max_high = in.readVector<double>();
+		base.acc.returns = in.readVector<double>();
+	}
 }
 
 void CandleMiner::makeReport(const ReportBuilder::Ptr& builder,
 		const std::string& filename)
 {
+	PROFILE_SCOPE("report");
 	std::sort(m_results.begin(), m_results.end(),
 			[] (const CandleMiner::Result& r1, const CandleMiner::Result& r2) {
 				return r1.count > r2.count;
@@ -362,14 +2055,38 @@ void CandleMiner::makeReport(const ReportBuilder::Ptr& builder,
 	double filterMeanP = m_reportConfig.get("filter-mean-p", 0).asDouble();
 	int filterCount = m_reportConfig.get("filter-count", 0).asInt();
 	bool filterTrivial = m_reportConfig.get("filter-trivial", false).asBool();
+	double filterQ = m_reportConfig.get("filter-q", 0).asDouble();
 
-	builder->start(outputFilename, TimePoint(0, 0), TimePoint(0, 0), std::list<std::string>());
+	builder->start(outputFilename, TimePoint(0), TimePoint(0), std::list<std::string>());
 	builder->begin_element("Parameters:");
 	builder->insert_text("Price tolerance: " + std::to_string(m_params.candleFit));
 	builder->insert_text("Volume tolerance: " + std::to_string(m_params.volumeFit));
-	builder->insert_text("Exit after: " + std::to_string(m_params.exitAfter) + " periods");
+	std::string horizons;
+	for(int exitAfter : m_params.exitHorizons)
+	{
+		if(!horizons.empty())
+			horizons += ", ";
+		horizons += std::to_string(exitAfter);
+	}
+	builder->insert_text("Exit after: " + horizons + " periods");
 	builder->insert_text("Momentum order: " + std::to_string(m_params.momentumOrder) + " periods");
 
+	if(m_params.validation)
+	{
+		std::string split;
+		for(const auto& ticker : m_params.testTickers)
+			split += (split.empty() ? "test tickers " : ", ") + ticker;
+		if(split.empty())
+		{
+			char buf[32];
+			struct tm tm;
+			gmtime_r(&m_params.splitTime, &tm);
+			strftime(buf, sizeof(buf), "%Y%m%d %H%M%S", &tm);
+			split = std::string("split at ") + buf + " UTC";
+		}
+		builder->insert_text("Validation: " + split);
+	}
+
 	if(filterP > 0)
 		builder->insert_text("Filter binomial p-value: < " + std::to_string(filterP));
 	if(filterMean > 0)
@@ -378,40 +2095,63 @@ void CandleMiner::makeReport(const ReportBuilder::Ptr& builder,
 		builder->insert_text("Filter absolute mean p-value: <" + std::to_string(filterMeanP));
 	if(filterCount > 0)
 		builder->insert_text("Filter pattern occurences: >" + std::to_string(filterCount));
+	if(m_params.resamples > 0)
+	{
+		builder->insert_text("Bootstrap resamples: " + std::to_string(m_params.resamples) +
+				"; seed: " + std::to_string(m_params.resamplingSeed));
+		if(filterQ > 0)
+			builder->insert_text("Filter Benjamini-Hochberg q-value: <" + std::to_string(filterQ));
+	}
 	builder->end_element();
 
-	int patternsCount = 0;
-	for(const auto& r : m_results)
-	{
+	// Statistical filters apply to each exit horizon, pattern is reported
+	// if any of its horizons passes
+	auto passesFilters = [&](const ExitStats& e) {
 		if(filterP > 0)
 		{
-			if(r.p > filterP)
-				continue;
+			if(e.p > filterP)
+				return false;
 		}
 
 		if(filterMean > 0)
 		{
-			if(fabs(r.mean) < filterMean)
-				continue;
+			if(fabs(e.mean) < filterMean)
+				return false;
 		}
 
-		if(filterCount > 0)
+		if(filterMeanP > 0)
 		{
-			if(r.count < filterCount)
-				continue;
+			if(e.mean_p > filterMeanP)
+				return false;
 		}
 
-		if(filterMeanP > 0)
+		if((filterQ > 0) && (m_params.resamples > 0))
+		{
+			if(e.q > filterQ)
+				return false;
+		}
+		return true;
+	};
+
+	size_t horizonsCount = m_params.exitHorizons.size();
+	int patternsCount = 0;
+	for(const auto& r : m_results)
+	{
+		if(std::none_of(r.exits, r.exits + horizonsCount, passesFilters))
+			continue;
+
+		if(filterCount > 0)
 		{
-			if(r.mean_p > filterMeanP)
+			if(r.count < filterCount)
 				continue;
 		}
 
 		if(filterTrivial)
 		{
 			bool isTrivial = true;
-			for(const auto& e : r.elements)
+			for(int i = 0; i < m_params.patternLength; i++)
 			{
+				const auto& e = r.elements[i];
 				if((e.open != 1) || (e.high != 1) || (e.low != 1) || (e.close != 1))
 				{
 					isTrivial = false;
@@ -423,19 +2163,46 @@ void CandleMiner::makeReport(const ReportBuilder::Ptr& builder,
 		}
 
 		builder->begin_element("Pattern: " + std::to_string(r.count) + " occurences");
-		builder->insert_fit_elements(r.elements);
-		builder->insert_text("mean = " + std::to_string(r.mean) + "; rejecting H0 at p-value: " +
-			  std::to_string(r.mean_p) + "; sigma = " + std::to_string(r.sigma));
-		builder->insert_text("Minmax returns: " + std::to_string(r.min_return) + "/" + std::to_string(r.max_return) +
-				"; median return: " + std::to_string(r.median));
-		builder->insert_text("+ returns: " + std::to_string((double)r.pos_returns / r.count) +
-				"; p-value: " + std::to_string(r.p));
-		builder->insert_text("min low: " + std::to_string(r.min_low) + "; max high: " + std::to_string(r.max_high));
-		builder->insert_text("mean +: " + std::to_string(r.mean_pos) + "; mean -: " + std::to_string(r.mean_neg));
+		builder->insert_fit_elements(std::vector<FitElement>(r.elements, r.elements + m_params.patternLength));
+		for(size_t h = 0; h < horizonsCount; h++)
+		{
+			const auto& e = r.exits[h];
+			if(horizonsCount > 1)
+				builder->insert_text("Exit after " + std::to_string(e.exitAfter) + " periods:");
+			builder->insert_text("mean = " + std::to_string(e.mean) + "; rejecting H0 at p-value: " +
+				  std::to_string(e.mean_p) + "; sigma = " + std::to_string(e.sigma));
+			builder->insert_text("Minmax returns: " + std::to_string(e.min_return) + "/" + std::to_string(e.max_return) +
+					"; median return: " + std::to_string(e.median));
+			builder->insert_text("+ returns: " + std::to_string((double)e.pos_returns / r.count) +
+					"; p-value: " + std::to_string(e.p));
+			builder->insert_text("min low: " + std::to_string(e.min_low) + "; max high: " + std::to_string(e.max_high));
+			builder->insert_text("mean +: " + std::to_string(e.mean_pos) + "; mean -: " + std::to_string(e.mean_neg));
+			if(m_params.resamples > 0)
+				builder->insert_text("bootstrap mean p-value: " + std::to_string(e.bootstrap_p) +
+						"; Benjamini-Hochberg q-value: " + std::to_string(e.q));
+			if(m_params.validation)
+			{
+				if(!r.testExits)
+				{
+					builder->insert_text("In-sample/out-of-sample: count = " + std::to_string(r.count) + "/" +
+							std::to_string(r.testCount) + "; not enough out-of-sample occurences");
+				}
+				else
+				{
+					const auto& t = r.testExits[h];
+					builder->insert_text("In-sample/out-of-sample: count = " + std::to_string(r.count) + "/" +
+							std::to_string(r.testCount) + "; mean = " + std::to_string(e.mean) + "/" + std::to_string(t.mean) +
+							"; mean p-value = " + std::to_string(e.mean_p) + "/" + std::to_string(t.mean_p) +
+							"; + returns = " + std::to_string((double)e.pos_returns / r.count) + "/" +
+							std::to_string((double)t.pos_returns / r.testCount) +
+							"; p-value = " + std::to_string(e.p) + "/" + std::to_string(t.p));
+				}
+			}
+		}
 		if(m_params.momentumOrder > 0)
 			builder->insert_text("Momentum sign: " + std::to_string(r.momentumSign));
 		if(m_params.fitSignatures)
-			builder->insert_text("Signature: " + r.signature);
+			builder->insert_text(std::string("Signature: ") + r.signature);
 		builder->end_element();
 
 		patternsCount += r.count;
@@ -3,23 +3,34 @@
 
 #include "model/quotes.h"
 #include "model/fitelement.h"
+#include "model/sparsetable.h"
+#include <deque>
+#include <functional>
 #include <list>
+#include "arena.h"
+#include "miners/columns.h"
 #include "miners/iminer.h"
+#include "miners/patternstore.h"
+
+class BinaryWriter;
+class BinaryReader;
+class Progress;
+template <typename T> class BoundedQueue;
 
 class CandleMiner : public IMiner
 {
 public:
-	struct Result
+	/*
+	 * Return statistics of matched windows for one exit horizon
+	 */
+	struct ExitStats
 	{
-		int momentumSign;
-		std::vector<FitElement> elements;
-		std::string signature;
+		int exitAfter;
 		double mean;
 		double sigma;
 		double mean_p;
 		double mean_pos;
 		double mean_neg;
-		int count;
 		int pos_returns;
 		double p;
 
@@ -29,8 +40,41 @@ public:
 
 		double min_low;
 		double max_high;
+
+		// Bootstrap p-value of the mean and its Benjamini-Hochberg
+		// adjustment over all results, if resampling is enabled
+		double bootstrap_p;
+		double q;
+	};
+
+	/*
+	 * Fixed-size record, so that sorting results moves no pattern data.
+	 * Elements and signature point to the base window in the pattern store
+	 * (or to the result arena if there's no store, as after merge), exit
+	 * statistics point to the result arena. Both live as long as the miner.
+	 */
+	struct Result
+	{
+		int momentumSign;
+		const FitElement* elements; // patternLength elements
+		const char* signature;
+		int count;
+		ExitStats* exits; // One per exit horizon
+
+		// Out-of-sample statistics, validation mode only
+		int testCount;
+		ExitStats* testExits; // Null if there are not enough out-of-sample matches
 	};
 
+	/*
+	 * How matched windows are grouped into patterns. Greedy scans bases in
+	 * window order, each claiming every window it fits. MatchGraph gives the
+	 * same result from fit relation computed once over i < j pairs. Clusters
+	 * are connected components of the fit relation: every window belongs to
+	 * exactly one pattern, independent of scan order and thread count.
+	 */
+	enum Grouping { GroupingGreedy, GroupingMatchGraph, GroupingClusters };
+
 	struct Params
 	{
 		Params() : candleFit(0.1), volumeFit(0),
@@ -38,16 +82,53 @@ public:
 			limit(-1),
 			exitAfter(1),
 			momentumOrder(-1),
-			fitSignatures(false)
+			fitSignatures(false),
+			quantizedPrefilter(false),
+			grouping(GroupingGreedy),
+			threads(0),
+			stateMaxMatches(0),
+			validation(false),
+			splitTime(0),
+			resamples(0),
+			resamplingSeed(1),
+			memoryBudget(1024)
 		{
 		}
 		double candleFit;
 		double volumeFit;
 		int patternLength;
 		double limit;
-		int exitAfter;
+		int exitAfter; // Longest of exit horizons
+		std::vector<int> exitHorizons;
 		int momentumOrder;
 		bool fitSignatures;
+		bool quantizedPrefilter;
+		Grouping grouping;
+		int threads; // Worker threads for match graph, 0 for hardware concurrency
+		// Incremental state keeps every match return of every base, so it
+		// grows by 8 bytes per match and horizon with each run. Bases may
+		// keep only their latest stateMaxMatches matches (0 keeps all): later
+		// runs then report statistics over those and new matches, while
+		// min_low and max_high still cover all of them
+		std::string stateFilename;
+		size_t stateMaxMatches;
+
+		// Walk-forward validation: patterns are mined on windows that exit
+		// before splitTime (or on tickers not in testTickers) and evaluated
+		// on windows starting from splitTime (or on testTickers)
+		bool validation;
+		time_t splitTime;
+		std::vector<std::string> testTickers;
+
+		int resamples; // Bootstrap resamples per pattern count, 0 to disable
+		uint64_t resamplingSeed;
+
+		// Out-of-core mode: tickers are written to column files in
+		// outOfCoreDirectory and windows are compared block by block, each
+		// block pair fitting memoryBudget (blocks have 1024 windows at least).
+		// Bootstrap population is sampled down to memoryBudget too.
+		std::string outOfCoreDirectory;
+		double memoryBudget; // Megabytes, positive
 	};
 
 	CandleMiner();
@@ -63,21 +144,177 @@ public:
 	virtual void makeReport(const ReportBuilder::Ptr& builder,
 			const std::string& filename);
 
-	struct Pattern
+	const Params& params() const { return m_params; }
+
+	virtual bool supportsShards() const { return true; }
+	virtual void saveShard(const std::string& filename);
+	virtual void mergeShards(const std::vector<std::string>& filenames);
+
+	typedef CandlePattern Pattern;
+
+	void setPatternStore(const PatternStore::Ptr& store);
+
+	/*
+	 * Writes quotes to a column file for out-of-core mining, so that they
+	 * needn't be kept in memory. Quotes given to setQuotes() are spilled by
+	 * mine() if none were spilled before. Column files are removed when the
+	 * miner is destroyed.
+	 */
+	void spill(const Quotes::Ptr& q);
+
+	/*
+	 * Full fit test, momentum sign included. Mining loops check momentum
+	 * sign before calling fit kernels directly.
+	 */
+	bool fit(const Pattern& f1, const Pattern& f2, int length);
+
+	/*
+	 * Fit tests specialized for the configured pattern length (2 to 8, or
+	 * generic), selected once when pattern length is set
+	 */
+	typedef bool (*FitKernel)(const Pattern& f1, const Pattern& f2, int length, const Params& params);
+	typedef bool (*QuantizedFitKernel)(const int16_t* q1, const int16_t* q2, int length, double candleFit);
+
+	/*
+	 * Statistics accumulated for every window matched by a base pattern.
+	 * Returns are kept in scan order, one per exit horizon for each match.
+	 */
+	struct Accumulator
 	{
-		int momentumSign;
-		std::vector<FitElement> elements;
-		std::string signature;
+		std::vector<double> returns;
+		std::vector<double> min_low;
+		std::vector<double> max_high;
+	};
+
+	struct Base
+	{
+		int ticker;
+		size_t pos;
+		Pattern pattern;
+		Accumulator acc;
+		std::vector<uint32_t> matches; // Matched window ids, sharded mining only
+		std::vector<int16_t> quantized; // Quantized pattern row, empty unless prefilter is enabled
+		Accumulator testAcc; // Out-of-sample matches, validation mode only
 	};
 
 private:
-	std::vector<Result> doMine(std::vector<Quotes::Ptr>& qlist);
-	bool fit(const Pattern& f1, const Pattern& f2, int length);
+	/*
+	 * Scan windows in scan order; only eligible ones may become bases
+	 */
+	struct WindowList
+	{
+		std::vector<uint32_t> ticker;
+		std::vector<uint32_t> pos;
+		std::vector<uint8_t> eligible;
+	};
+
+	/*
+	 * Consecutive windows of one column file, out-of-core mode only
+	 */
+	struct Slice
+	{
+		size_t file;
+		size_t first;
+		size_t windows;
+	};
+
+	/*
+	 * Symmetric fit relation over WindowList in compressed sparse rows,
+	 * neighbours of every window in ascending order
+	 */
+	struct MatchGraph
+	{
+		std::vector<uint64_t> offsets;
+		std::vector<uint32_t> adjacent;
+	};
+
+	void doMine(std::vector<Quotes::Ptr>& qlist);
+	void matchBases(std::vector<Quotes::Ptr>& qlist, const std::vector<size_t>& firstNew, bool resumed,
+			Progress& progress, BoundedQueue<const Base*>& finished);
+	void doMineShard(std::vector<Quotes::Ptr>& qlist);
+	void doMineGraph(std::vector<Quotes::Ptr>& qlist);
+	void doMineClusters(std::vector<Quotes::Ptr>& qlist);
+	void doMineValidation(std::vector<Quotes::Ptr>& qlist);
+	void doMineOutOfCore();
+	std::vector<std::vector<Slice>> planBlocks() const;
+	void loadBlock(const std::vector<Slice>& block);
+	std::vector<uint8_t> splitWindows(const std::vector<Quotes::Ptr>& qlist, const WindowList& windows) const;
+	void makeResults();
+	void finishResults();
+	void calculatePValues();
+	std::vector<std::vector<double>> nullPopulations() const;
+	void calculateBootstrapPValues(const std::vector<std::vector<double>>& populations);
+	void updateMined(const std::vector<Quotes::Ptr>& qlist);
+
+	size_t windowCount(const Quotes::Ptr& q) const;
+	size_t windowCount(size_t candles) const;
+	void buildPatterns(const std::vector<Quotes::Ptr>& qlist);
+	void buildColumns(const Quotes& q, const std::vector<int8_t>& momentum, size_t ticker, size_t windows);
+	Pattern pattern(size_t id) const;
+	std::vector<int16_t> quantizedRow(const Pattern& p) const;
+	bool matches(const Base& base, size_t id);
+	size_t matchTiled(const std::vector<Base*>& bases, const std::vector<size_t>& firstScan,
+			const std::function<void(size_t base, size_t ticker, uint32_t pos)>& onMatch);
+	void addMatch(Accumulator& acc, size_t ticker, size_t pos);
+	bool makeResult(const Base& base, Result& r);
+	ExitStats* exitStats(const Accumulator& acc);
+	void normalizeExitHorizons();
+	void selectKernels();
+
+	WindowList listWindows(const std::vector<Quotes::Ptr>& qlist) const;
+	void findFitPairs(const WindowList& windows,
+			const std::function<void(int thread, uint32_t i, uint32_t j)>& onPair, int threads, bool skipIneligible);
+	MatchGraph buildMatchGraph(const WindowList& windows);
+	int threadCount() const;
+
+	std::vector<Quotes::Ptr> orderQuotes(const std::vector<Quotes::Ptr>& quotes);
+	void loadState(const std::string& filename);
+	void saveState(const std::string& filename);
+	void writeState(BinaryWriter& out, size_t maxMatches);
+	void readState(BinaryReader& in, const std::string& filename);
+	void saveCheckpoint(const std::vector<Quotes::Ptr>& qlist);
+	std::vector<std::pair<std::string, size_t>> loadCheckpoint(const std::string& filename);
 
 private:
+	struct MinedTicker
+	{
+		std::string name;
+		size_t candles;
+		size_t windows;
+		time_t lastTime;
+	};
+
+	/*
+	 * Position of the next base window to process and windows already
+	 * claimed by a base, as saved in checkpoints
+	 */
+	struct ScanState
+	{
+		ScanState() : ticker(0), pos(0)
+		{
+		}
+
+		size_t ticker;
+		size_t pos;
+		std::vector<uint8_t> scanned;
+	};
+
 	Params m_params;
+	FitKernel m_fitKernel;
+	QuantizedFitKernel m_quantizedFitKernel;
 	std::vector<Quotes::Ptr> m_quotes;
+	std::vector<ColumnFile::Ptr> m_columnFiles;
+	std::vector<std::string> m_spilledFilenames;
+	PatternStore::Ptr m_store;
+	std::vector<int8_t> m_momentum; // Momentum sign of every window id
+	std::vector<MomentumBuckets> m_buckets; // Scan windows of every ticker by momentum sign
+	std::vector<RangeMinTable> m_lows;
+	std::vector<RangeMaxTable> m_highs;
+	std::vector<MinedTicker> m_mined;
+	std::deque<Base> m_bases; // Deque keeps bases in place for the aggregate stage
+	ScanState m_scan;
 	std::vector<Result> m_results;
+	Arena m_resultArena;
 	Json::Value m_reportConfig;
 };
 
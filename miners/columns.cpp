@@ -0,0 +1,125 @@
+#include "columns.h"
+#include "binaryio.h"
+#include <cstring>
+#include <stdexcept>
+
+static const uint32_t ColumnFileMagic = 0x4c434d50; // "PMCL"
+static const uint32_t ColumnFileVersion = 1;
+
+/*
+ * Name follows the header and is padded so that columns are 8-byte aligned
+ */
+struct ColumnFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t length;
+	int32_t momentumOrder;
+	uint32_t nameSize;
+};
+
+static size_t columnsOffset(size_t nameSize)
+{
+	return (sizeof(ColumnFileHeader) + nameSize + 7) / 8 * 8;
+}
+
+std::vector<int8_t> momentumColumn(const Quotes& q, int momentumOrder)
+{
+	std::vector<int8_t> result(q.length(), 0);
+	if(momentumOrder <= 0)
+		return result;
+	for(size_t pos = momentumOrder; pos < q.length(); pos++)
+	{
+		result[pos] = q[pos - momentumOrder].close - q[pos].open > 0 ? 1 : -1;
+	}
+	return result;
+}
+
+MomentumBuckets::MomentumBuckets()
+{
+}
+
+MomentumBuckets::MomentumBuckets(const std::vector<int8_t>& momentum, size_t count)
+{
+	if(count > momentum.size())
+		throw std::runtime_error("Momentum column is shorter than bucketed positions");
+	for(size_t pos = 0; pos < count; pos++)
+	{
+		m_buckets[momentum[pos] + 1].push_back(pos);
+	}
+}
+
+void writeColumnFile(const std::string& filename, const Quotes& q, int momentumOrder)
+{
+	size_t n = q.length();
+	auto name = q.name();
+	ColumnFileHeader header = { ColumnFileMagic, ColumnFileVersion, n, momentumOrder, (uint32_t)name.size() };
+
+	BinaryWriter out(filename);
+	out.write(header);
+	out.writeRaw(name.data(), name.size());
+	static const char padding[8] = {};
+	out.writeRaw(padding, columnsOffset(name.size()) - sizeof(header) - name.size());
+
+	std::vector<double> prices(n);
+	for(auto field : { &Candle::open, &Candle::high, &Candle::low, &Candle::close })
+	{
+		for(size_t pos = 0; pos < n; pos++)
+			prices[pos] = q[pos].*field;
+		out.writeRaw(prices.data(), n * sizeof(double));
+	}
+	std::vector<uint64_t> volumes(n);
+	std::vector<int64_t> times(n);
+	for(size_t pos = 0; pos < n; pos++)
+	{
+		volumes[pos] = q[pos].volume;
+		times[pos] = q[pos].time.sec;
+	}
+	out.writeRaw(volumes.data(), n * sizeof(uint64_t));
+	out.writeRaw(times.data(), n * sizeof(int64_t));
+	auto momentum = momentumColumn(q, momentumOrder);
+	out.writeRaw(momentum.data(), n);
+	out.commit();
+}
+
+ColumnFile::ColumnFile(const std::string& filename) :
+	m_file(filename.c_str(), boost::interprocess::read_only),
+	m_region(m_file, boost::interprocess::read_only)
+{
+	auto data = static_cast<const char*>(m_region.get_address());
+	size_t size = m_region.get_size();
+	ColumnFileHeader header;
+	if(size < sizeof(header))
+		throw std::runtime_error("Not a column file: " + filename);
+	memcpy(&header, data, sizeof(header));
+	if(header.magic != ColumnFileMagic)
+		throw std::runtime_error("Not a column file: " + filename);
+	if(header.version != ColumnFileVersion)
+		throw std::runtime_error("Unsupported column file version: " + filename);
+
+	size_t offset = columnsOffset(header.nameSize);
+	if(size != offset + header.length * (6 * 8 + 1))
+		throw std::runtime_error("Column file is truncated: " + filename);
+	m_name.assign(data + sizeof(header), header.nameSize);
+	m_length = header.length;
+	m_momentumOrder = header.momentumOrder;
+
+	auto column = [&](size_t index) { return data + offset + index * m_length * 8; };
+	m_open = reinterpret_cast<const double*>(column(0));
+	m_high = reinterpret_cast<const double*>(column(1));
+	m_low = reinterpret_cast<const double*>(column(2));
+	m_close = reinterpret_cast<const double*>(column(3));
+	m_volume = reinterpret_cast<const uint64_t*>(column(4));
+	m_time = reinterpret_cast<const int64_t*>(column(5));
+	m_momentum = reinterpret_cast<const int8_t*>(column(6));
+}
+
+Quotes::Ptr ColumnFile::slice(size_t first, size_t count) const
+{
+	if(first + count > m_length)
+		throw std::runtime_error("Slice is out of column file range: " + m_name);
+	auto q = std::make_shared<Quotes>(m_name);
+	for(size_t pos = first; pos < first + count; pos++)
+		q->append(Candle(m_open[pos], m_high[pos], m_low[pos], m_close[pos], m_volume[pos], TimePoint(m_time[pos])));
+	return q;
+}
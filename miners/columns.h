@@ -0,0 +1,84 @@
+#ifndef COLUMNS_H_B8WN2JRA
+#define COLUMNS_H_B8WN2JRA
+
+#include "model/quotes.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Momentum sign at every position of the ticker: 1 if the open is below the
+ * close momentumOrder bars earlier, -1 otherwise, and 0 if momentum is
+ * disabled or not enough bars precede the position
+ */
+std::vector<int8_t> momentumColumn(const Quotes& q, int momentumOrder);
+
+/*
+ * Positions of one ticker below count partitioned by momentum sign, each
+ * bucket in ascending order. Miners compare a base only with the bucket of
+ * its own sign, in the same order as a full scan would.
+ */
+class MomentumBuckets
+{
+public:
+	MomentumBuckets();
+	MomentumBuckets(const std::vector<int8_t>& momentum, size_t count);
+
+	const std::vector<uint32_t>& operator[](int sign) const { return m_buckets[sign + 1]; }
+
+private:
+	std::vector<uint32_t> m_buckets[3];
+};
+
+/*
+ * Writes quotes of one ticker as a column file: open, high, low and close
+ * prices, volumes, times and momentum signs of given order, each column
+ * stored contiguously
+ */
+void writeColumnFile(const std::string& filename, const Quotes& q, int momentumOrder);
+
+/*
+ * Read-only memory mapping of a column file. Pages are loaded by the OS on
+ * access, so a ticker needn't fit in memory to be mined.
+ */
+class ColumnFile
+{
+public:
+	typedef std::shared_ptr<ColumnFile> Ptr;
+
+	explicit ColumnFile(const std::string& filename);
+
+	const std::string& name() const { return m_name; }
+	size_t length() const { return m_length; }
+	int momentumOrder() const { return m_momentumOrder; }
+
+	const double* open() const { return m_open; }
+	const double* high() const { return m_high; }
+	const double* low() const { return m_low; }
+	const double* close() const { return m_close; }
+	const uint64_t* volume() const { return m_volume; }
+	const int64_t* time() const { return m_time; }
+	const int8_t* momentum() const { return m_momentum; }
+
+	// Candles [first, first + count) copied to memory
+	Quotes::Ptr slice(size_t first, size_t count) const;
+
+private:
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+	std::string m_name;
+	size_t m_length;
+	int m_momentumOrder;
+	const double* m_open;
+	const double* m_high;
+	const double* m_low;
+	const double* m_close;
+	const uint64_t* m_volume;
+	const int64_t* m_time;
+	const int8_t* m_momentum;
+};
+
+#endif /* end of include guard: COLUMNS_H_B8WN2JRA */
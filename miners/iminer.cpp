@@ -3,8 +3,13 @@
  */
 
 #include "iminer.h"
+#include <stdexcept>
 
-IMiner::IMiner()
+IMiner::IMiner() : m_checkpointInterval(0),
+	m_resume(false),
+	m_shardIndex(0),
+	m_shardCount(0),
+	m_comparisons(0)
 {
 
 }
@@ -13,3 +18,43 @@ IMiner::~IMiner()
 {
 }
 
+void IMiner::setCheckpoint(const std::string& filename, int intervalSeconds, bool resume)
+{
+	m_checkpointFilename = filename;
+	m_checkpointInterval = intervalSeconds;
+	m_resume = resume;
+	m_lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+void IMiner::setShard(int index, int count)
+{
+	if((count <= 0) || (index < 0) || (index >= count))
+		throw std::runtime_error("Invalid shard specification");
+	if(!supportsShards())
+		throw std::runtime_error("Sharded mining is not supported by this miner");
+	m_shardIndex = index;
+	m_shardCount = count;
+}
+
+void IMiner::saveShard(const std::string& filename)
+{
+	throw std::runtime_error("Sharded mining is not supported by this miner");
+}
+
+void IMiner::mergeShards(const std::vector<std::string>& filenames)
+{
+	throw std::runtime_error("Sharded mining is not supported by this miner");
+}
+
+bool IMiner::checkpointDue()
+{
+	if(m_checkpointFilename.empty())
+		return false;
+
+	auto now = std::chrono::steady_clock::now();
+	if(now - m_lastCheckpoint < std::chrono::seconds(m_checkpointInterval))
+		return false;
+
+	m_lastCheckpoint = now;
+	return true;
+}
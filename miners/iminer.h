@@ -8,6 +8,8 @@
 #include "json/value.h"
 #include "model/quotes.h"
 #include "report/builder.h"
+#include <chrono>
+#include <cstdint>
 #include <memory>
 
 class IMiner
@@ -25,6 +27,41 @@ public:
 
 	virtual void makeReport(const ReportBuilder::Ptr& builder,
 			const std::string& filename) = 0;
+
+	/*
+	 * Enables periodic checkpoints of mining progress. With resume set,
+	 * mine() continues from the checkpoint file if it exists.
+	 */
+	void setCheckpoint(const std::string& filename, int intervalSeconds, bool resume);
+
+	/*
+	 * Restricts mining to base positions of given shard (0 <= index < count).
+	 * Partial results are written by saveShard() and combined by mergeShards()
+	 * instead of mine(). Throws if the miner has no shard mode.
+	 */
+	void setShard(int index, int count);
+	virtual bool supportsShards() const { return false; }
+	virtual void saveShard(const std::string& filename);
+	virtual void mergeShards(const std::vector<std::string>& filenames);
+
+	/*
+	 * Number of window comparisons made by mine() so far
+	 */
+	uint64_t comparisons() const { return m_comparisons; }
+
+protected:
+	bool checkpointDue();
+
+protected:
+	std::string m_checkpointFilename;
+	int m_checkpointInterval;
+	bool m_resume;
+	int m_shardIndex;
+	int m_shardCount;
+	uint64_t m_comparisons;
+
+private:
+	std::chrono::steady_clock::time_point m_lastCheckpoint;
 };
 
 #endif /* MINERS_IMINER_H_ */
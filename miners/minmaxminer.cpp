@@ -1,15 +1,17 @@
 
 #include "minmaxminer.h"
 #include "log.h"
+#include "binaryio.h"
+#include "profiler.h"
+#include "progress.h"
+#include "statistics.h"
+#include "columns.h"
+#include <boost/filesystem.hpp>
 #include <cassert>
 #include <cmath>
-#include <boost/math/distributions.hpp> 
 
-using namespace boost::math;
 static const int MaxZigzags = 32;
 
-static const double alpha[] = { 0.00001, 0.0001, 0.001, 0.01, 0.05, 0.10, 0.25, 0.5, 1 };
-
 static bool isExtremum(const Quotes::Ptr& q, size_t pos, int epsilon, bool minimum)
 {
 	if(((int)pos < epsilon) || (pos > q->length() - epsilon - 1))
@@ -46,8 +48,9 @@ static bool isMaximum(const Quotes::Ptr& q, size_t pos, int epsilon)
 	return isExtremum(q, pos, epsilon, false);
 }
 
-static std::vector<ZigzagElement> findZigzags(const Quotes::Ptr& q, size_t start_pos, int epsilon, int zigzags)
+std::vector<ZigzagElement> findZigzags(const Quotes::Ptr& q, size_t start_pos, int epsilon, int zigzags)
 {
+	PROFILE_SCOPE("zigzags");
 	assert(zigzags > 1);
 
 	std::vector<ZigzagElement> result;
@@ -92,24 +95,16 @@ static std::vector<ZigzagElement> findZigzags(const Quotes::Ptr& q, size_t start
 	return result;
 }
 
-bool MinmaxMiner::matchZigzags(const Quotes::Ptr& q, size_t pos, const std::vector<ZigzagElement>& zigzags, double tolerance, int momentumSign)
+/*
+ * Momentum sign is not checked, as only positions of the base's momentum
+ * bucket are scanned
+ */
+bool MinmaxMiner::matchZigzags(const Quotes::Ptr& q, size_t pos, const std::vector<ZigzagElement>& zigzags, double tolerance)
 {
 	auto currentZigzags = findZigzags(q, pos, m_params.epsilon, zigzags.size());
 	if(currentZigzags.size() != zigzags.size())
 		return false;
 
-	int thisMomentumSign = 0;
-	if(m_params.momentumOrder > 0)
-	{
-		if((int)pos - m_params.momentumOrder < 0)
-			thisMomentumSign = 0;
-		else
-			thisMomentumSign = q->at(pos - m_params.momentumOrder).close - q->at(pos).open > 0 ? 1 : -1;
-	}
-
-	if(thisMomentumSign != momentumSign)
-		return false;
-
 	for(size_t i = 0; i < currentZigzags.size(); i++)
 	{
 		if(fabs(currentZigzags[i].price - zigzags[i].price) > tolerance)
@@ -140,49 +135,90 @@ MinmaxMiner::~MinmaxMiner()
 {
 }
 
+/*
+ * Significance of all patterns in one batch after mining
+ */
+static void calculatePValues(std::vector<MinmaxMiner::Result>& result)
+{
+	std::vector<int> counts, posReturns;
+	std::vector<double> means, sigmas;
+	for(const auto& r : result)
+	{
+		counts.push_back(r.count);
+		posReturns.push_back(r.pos_returns);
+		means.push_back(r.mean);
+		sigmas.push_back(r.sigma);
+	}
+
+	std::vector<double> p(result.size()), meanP(result.size());
+	binomialPValues(counts.data(), posReturns.data(), result.size(), p.data());
+	meanPValues(counts.data(), means.data(), sigmas.data(), result.size(), meanP.data());
+	for(size_t i = 0; i < result.size(); i++)
+	{
+		result[i].p = p[i];
+		result[i].mean_p = meanP[i];
+	}
+}
+
 std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& qlist)
 {
 	std::vector<MinmaxMiner::Result> result;
+	m_resultArena.clear();
 
-	int total_positions = 0;
+	std::vector<size_t> offsets;
+	size_t total_positions = 0;
 	for(const auto& q : qlist)
 	{
+		offsets.push_back(total_positions);
 		total_positions += q->length();
 	}
-	std::vector<int> scanned(total_positions, 0);
-	int baseIndex = 0;
-	for(const auto& qbase : qlist)
+
+	size_t firstTicker = 0;
+	size_t firstPos = 0;
+	std::vector<uint8_t> scanned;
+	if(m_resume && boost::filesystem::exists(m_checkpointFilename))
+	{
+		loadCheckpoint(m_checkpointFilename, qlist, firstTicker, firstPos, scanned, result);
+		LOG(INFO) << "Resuming from checkpoint: " << result.size() << " patterns found";
+	}
+	else
+	{
+		scanned.assign(total_positions, 0);
+	}
+	Progress progress("MinmaxMiner", total_positions);
+
+	std::vector<std::vector<int8_t>> momentum;
+	std::vector<MomentumBuckets> buckets;
+	for(const auto& q : qlist)
+	{
+		momentum.push_back(momentumColumn(*q, m_params.momentumOrder));
+		buckets.emplace_back(momentum.back(), q->length());
+	}
+
+	for(size_t ticker = firstTicker; ticker < qlist.size(); ticker++)
 	{
-		int last_percent = 0;
-		for(size_t pos = 0; pos < qbase->length() - 1; pos++)
+		const auto& qbase = qlist[ticker];
+		size_t baseIndex = offsets[ticker];
+		for(size_t pos = (ticker == firstTicker ? firstPos : 0); pos < qbase->length() - 1; pos++)
 		{
 			if(m_params.limit > 0)
 			{
 				if((double)pos / qbase->length() * 100 > (size_t)m_params.limit)
 					break;
 			}
+			progress.advance();
+
+			if(checkpointDue())
+				saveCheckpoint(qlist, ticker, pos, scanned, result);
 
 			if(scanned[baseIndex + pos])
 				continue;
 
-			int current_percent = (double)pos / qbase->length() * 1000;
-			if(current_percent != last_percent)
-			{
-				LOG(DEBUG) << qbase->name() << ": " << (double)current_percent / 10 << "% done";
-				last_percent = current_percent;
-			}
 			auto zigzags = findZigzags(qbase, pos, m_params.epsilon, m_params.zigzags);
 			if(zigzags.size() < (size_t)m_params.zigzags)
 				continue;
 
-			int baseMomentumSign = 0;
-			if(m_params.momentumOrder > 0)
-			{
-				if((int)pos - m_params.momentumOrder < 0)
-					baseMomentumSign = 0;
-				else
-					baseMomentumSign = qbase->at(pos - m_params.momentumOrder).close - qbase->at(pos).open > 0 ? 1 : -1;
-			}
+			int baseMomentumSign = momentum[ticker][pos];
 
 			double mean = 0;
 			int counter = 0;
@@ -204,12 +240,16 @@ std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& q
 			}
 			double tolerance = (abs_max - abs_min) * m_params.priceTolerance;
 
-			int scanIndex = 0;
-			for(const auto& qscan : qlist)
+			size_t compared = 0;
+			for(size_t scanTicker = 0; scanTicker < qlist.size(); scanTicker++)
 			{
-				for(size_t scanPos = 0; scanPos < qscan->length(); scanPos++)
+				const auto& qscan = qlist[scanTicker];
+				size_t scanIndex = offsets[scanTicker];
+				const auto& bucket = buckets[scanTicker][baseMomentumSign];
+				compared += bucket.size();
+				for(uint32_t scanPos : bucket)
 				{
-					if(matchZigzags(qscan, scanPos, zigzags, tolerance, baseMomentumSign))
+					if(matchZigzags(qscan, scanPos, zigzags, tolerance))
 					{
 						size_t lastPos = scanPos + zigzags.back().time + m_params.epsilon;
 						size_t exitPos = lastPos + m_params.exitAfter;
@@ -240,8 +280,10 @@ std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& q
 						scanned[scanIndex + scanPos] = 1;
 					}
 				}
-				scanIndex += qscan->length();
 			}
+			progress.addMatches(counter);
+			progress.addComparisons(compared);
+			m_comparisons += compared;
 
 			if(counter > 1)
 			{
@@ -249,7 +291,8 @@ std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& q
 				sigma = sigma / counter;
 				Result r;
 				r.momentumSign = baseMomentumSign;
-				r.elements = zigzags;
+				r.elements = m_resultArena.copy(zigzags.data(), zigzags.size());
+				r.elementsCount = zigzags.size();
 				r.mean = mean;
 				r.sigma = sqrt(sigma - mean * mean);
 				r.count = counter;
@@ -257,31 +300,8 @@ std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& q
 				r.neg_returns = neg_returns;
 				r.min_return = min_return;
 				r.max_return = max_return;
-
-				double binomial_sigma = sqrt(counter);
-				double q = fabs(pos_returns - (double)counter / 2) / binomial_sigma;
-				double p = (1 - erf(q));
-				r.p = p;
-
-				students_t dist(counter - 1);
-
-				double students_factor = r.sigma / sqrt(counter);
-				r.mean_p  = 1;
-				for(auto a : alpha)
-				{
-					double T = quantile(complement(dist, a / 2));
-					if((mean > 0) && (mean - T * students_factor > 0))
-					{
-						r.mean_p = a;
-						break;
-					}
-
-					if((mean < 0) && (mean + T * students_factor < 0))
-					{
-						r.mean_p = a;
-						break;
-					}
-				}
+				r.p = 1;
+				r.mean_p = 1;
 
 				if((counter % 2) == 0)
 				{
@@ -295,12 +315,119 @@ std::vector<MinmaxMiner::Result> MinmaxMiner::doMine(std::vector<Quotes::Ptr>& q
 				result.push_back(r);
 			}
 		}
-		baseIndex += qbase->length();
 	}
 
+	calculatePValues(result);
+
+	if(!m_checkpointFilename.empty())
+		saveCheckpoint(qlist, qlist.size(), 0, scanned, result);
+
 	return result;
 }
 
+static const uint32_t CheckpointMagic = 0x5a434d50; // "PMCZ"
+static const uint32_t CheckpointVersion = 1;
+
+void MinmaxMiner::saveCheckpoint(const std::vector<Quotes::Ptr>& qlist, size_t ticker, size_t pos,
+		const std::vector<uint8_t>& scanned, const std::vector<Result>& result)
+{
+	BinaryWriter out(m_checkpointFilename);
+	out.write(CheckpointMagic);
+	out.write(CheckpointVersion);
+	out.write(m_params.limit);
+	out.write<int32_t>(m_params.exitAfter);
+	out.write<int32_t>(m_params.timeTolerance);
+	out.write<int32_t>(m_params.zigzags);
+	out.write<int32_t>(m_params.epsilon);
+	out.write(m_params.priceTolerance);
+	out.write(m_params.volumeTolerance);
+	out.write<int32_t>(m_params.momentumOrder);
+
+	out.write<uint64_t>(qlist.size());
+	for(const auto& q : qlist)
+	{
+		out.writeString(q->name());
+		out.write<uint64_t>(q->length());
+	}
+	out.write<uint64_t>(ticker);
+	out.write<uint64_t>(pos);
+	out.writeVector(scanned);
+
+	out.write<uint64_t>(result.size());
+	for(const auto& r : result)
+	{
+		out.write<uint64_t>(r.elementsCount);
+		out.writeRaw(r.elements, r.elementsCount * sizeof(ZigzagElement));
+		out.write(r.mean);
+		out.write(r.mean_p);
+		out.write(r.sigma);
+		out.write<int32_t>(r.count);
+		out.write<int32_t>(r.pos_returns);
+		out.write<int32_t>(r.neg_returns);
+		out.write(r.p);
+		out.write(r.min_return);
+		out.write(r.max_return);
+		out.write(r.median);
+		out.write<int32_t>(r.momentumSign);
+	}
+	out.commit();
+	LOG(DEBUG) << "Checkpoint saved at " << ticker << ":" << pos;
+}
+
+void MinmaxMiner::loadCheckpoint(const std::string& filename, const std::vector<Quotes::Ptr>& qlist,
+		size_t& ticker, size_t& pos, std::vector<uint8_t>& scanned, std::vector<Result>& result)
+{
+	BinaryReader in(filename);
+	if(in.read<uint32_t>() != CheckpointMagic)
+		throw std::runtime_error("Not a checkpoint file: " + filename);
+	if(in.read<uint32_t>() != CheckpointVersion)
+		throw std::runtime_error("Unsupported checkpoint version: " + filename);
+
+	bool compatible = true;
+	compatible &= in.read<double>() == m_params.limit;
+	compatible &= in.read<int32_t>() == m_params.exitAfter;
+	compatible &= in.read<int32_t>() == m_params.timeTolerance;
+	compatible &= in.read<int32_t>() == m_params.zigzags;
+	compatible &= in.read<int32_t>() == m_params.epsilon;
+	compatible &= in.read<double>() == m_params.priceTolerance;
+	compatible &= in.read<double>() == m_params.volumeTolerance;
+	compatible &= in.read<int32_t>() == m_params.momentumOrder;
+	if(!compatible)
+		throw std::runtime_error("Checkpoint was created with different miner parameters: " + filename);
+
+	if(in.read<uint64_t>() != qlist.size())
+		throw std::runtime_error("Checkpoint does not match loaded quotes");
+	for(const auto& q : qlist)
+	{
+		auto name = in.readString();
+		auto length = in.read<uint64_t>();
+		if((name != q->name()) || (length != q->length()))
+			throw std::runtime_error("Checkpoint does not match loaded quotes: " + q->name());
+	}
+	ticker = in.read<uint64_t>();
+	pos = in.read<uint64_t>();
+	scanned = in.readVector<uint8_t>();
+
+	result.resize(in.readCount(sizeof(uint64_t)));
+	for(auto& r : result)
+	{
+		auto elements = in.readVector<ZigzagElement>();
+		r.elements = m_resultArena.copy(elements.data(), elements.size());
+		r.elementsCount = elements.size();
+		r.mean = in.read<double>();
+		r.mean_p = in.read<double>();
+		r.sigma = in.read<double>();
+		r.count = in.read<int32_t>();
+		r.pos_returns = in.read<int32_t>();
+		r.neg_returns = in.read<int32_t>();
+		r.p = in.read<double>();
+		r.min_return = in.read<double>();
+		r.max_return = in.read<double>();
+		r.median = in.read<double>();
+		r.momentumSign = in.read<int32_t>();
+	}
+}
+
 
 void MinmaxMiner::parseConfig(const Json::Value& root)
 {
@@ -325,12 +452,14 @@ void MinmaxMiner::setQuotes(const std::vector<Quotes::Ptr>& quotes)
 
 void MinmaxMiner::mine()
 {
+	PROFILE_SCOPE("mine");
 	m_results = doMine(m_quotes);
 }
 
 void MinmaxMiner::makeReport(const ReportBuilder::Ptr& builder,
 		const std::string& filename)
 {
+	PROFILE_SCOPE("report");
 	std::sort(m_results.begin(), m_results.end(), [] (const MinmaxMiner::Result& r1, const MinmaxMiner::Result& r2) {
 			return r1.count > r2.count;
 			});
@@ -342,7 +471,7 @@ void MinmaxMiner::makeReport(const ReportBuilder::Ptr& builder,
 	int filterCount = m_reportConfig.get("filter-count", 0).asInt();
 	bool filterTrivial = m_reportConfig.get("filter-trivial", false).asBool();
 
-	builder->start(outputFilename, TimePoint(0, 0), TimePoint(0, 0), std::list<std::string>());
+	builder->start(outputFilename, TimePoint(0), TimePoint(0), std::list<std::string>());
 	builder->begin_element("Parameters:");
 	builder->insert_text("Price tolerance: " + std::to_string(m_params.priceTolerance));
 	builder->insert_text("Volume tolerance: " + std::to_string(m_params.volumeTolerance));
@@ -390,9 +519,9 @@ void MinmaxMiner::makeReport(const ReportBuilder::Ptr& builder,
 		if(filterTrivial)
 		{
 			bool isTrivial = true;
-			for(const auto& e : r.elements)
+			for(int i = 0; i < r.elementsCount; i++)
 			{
-				if(e.price != 1)
+				if(r.elements[i].price != 1)
 				{
 					isTrivial = false;
 					break;
@@ -403,8 +532,9 @@ void MinmaxMiner::makeReport(const ReportBuilder::Ptr& builder,
 		}
 
 		builder->begin_element("Pattern: " + std::to_string(r.count) + " occurences");
-		for(const auto& el : r.elements)
+		for(int i = 0; i < r.elementsCount; i++)
 		{
+			const auto& el = r.elements[i];
 			builder->insert_text("Z" + std::to_string(el.time) + ":" + std::to_string(el.price) + "/" + std::to_string(el.volume) + "(" + (el.minimum ? std::string("min") : std::string("max")) + ")");
 		}
 		builder->insert_text("mean = " + std::to_string(r.mean) + "; rejecting H0 at p-value: " +
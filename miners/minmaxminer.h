@@ -6,14 +6,24 @@
 #include <list>
 #include "model/quotes.h"
 #include "model/fitelement.h"
+#include "arena.h"
 #include "miners/iminer.h"
 
+/*
+ * Up to 'zigzags' local extrema of epsilon order starting at start_pos
+ */
+std::vector<ZigzagElement> findZigzags(const Quotes::Ptr& q, size_t start_pos, int epsilon, int zigzags);
+
 class MinmaxMiner : public IMiner
 {
 public:
+	/*
+	 * Fixed-size record, zigzags are kept in the result arena
+	 */
 	struct Result
 	{
-		std::vector<ZigzagElement> elements;
+		const ZigzagElement* elements;
+		int elementsCount;
 
 		double mean;
 		double mean_p;
@@ -68,12 +78,18 @@ public:
 
 private:
 	std::vector<Result> doMine(std::vector<Quotes::Ptr>& qlist);
-	bool matchZigzags(const Quotes::Ptr& q, size_t pos, const std::vector<ZigzagElement>& zigzags, double tolerance, int momentumSign);
+	bool matchZigzags(const Quotes::Ptr& q, size_t pos, const std::vector<ZigzagElement>& zigzags, double tolerance);
+
+	void saveCheckpoint(const std::vector<Quotes::Ptr>& qlist, size_t ticker, size_t pos,
+			const std::vector<uint8_t>& scanned, const std::vector<Result>& result);
+	void loadCheckpoint(const std::string& filename, const std::vector<Quotes::Ptr>& qlist,
+			size_t& ticker, size_t& pos, std::vector<uint8_t>& scanned, std::vector<Result>& result);
 
 private:
 	Params m_params;
 	std::vector<Quotes::Ptr> m_quotes;
 	std::vector<Result> m_results;
+	Arena m_resultArena;
 	Json::Value m_reportConfig;
 };
 
@@ -0,0 +1,208 @@
+
+#include "patternstore.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "profiler.h"
+
+struct SignatureElement
+{
+
+	SignatureElement(double p, char type, int index) : price(p), sign(type + std::to_string(index))
+	{
+	}
+
+	double price;
+	std::string sign;
+};
+
+/*
+ * Length is the pattern length known at compile time, or 0 to take it from
+ * patternLength argument
+ */
+template <int Length>
+static CandlePattern convertToRelativeUnits(Quotes& q, size_t startPos, int patternLength)
+{
+	const int n = Length > 0 ? Length : patternLength;
+	auto startPrice = q[startPos].open;
+	double startVolume = q[startPos].volume;
+	CandlePattern pattern;
+	pattern.momentumSign = 0;
+	pattern.elements.resize(n);
+	FitElement* el = pattern.elements.data();
+	for(int i = 0; i < n; i++)
+	{
+		Candle c = q[startPos + i];
+		el[i].open = c.open / startPrice;
+		el[i].high = c.high / startPrice;
+		el[i].low = c.low / startPrice;
+		el[i].close = c.close / startPrice;
+		el[i].volume = (double)c.volume / startVolume;
+	}
+	pattern.low = el[0].low;
+	pattern.high = el[0].high;
+	for(int i = 1; i < n; i++)
+	{
+		pattern.low = std::min(pattern.low, el[i].low);
+		pattern.high = std::max(pattern.high, el[i].high);
+	}
+	return pattern;
+}
+
+static PatternStore::NormalizeKernel selectNormalizeKernel(int patternLength)
+{
+	switch(patternLength)
+	{
+		case 2: return convertToRelativeUnits<2>;
+		case 3: return convertToRelativeUnits<3>;
+		case 4: return convertToRelativeUnits<4>;
+		case 5: return convertToRelativeUnits<5>;
+		case 6: return convertToRelativeUnits<6>;
+		case 7: return convertToRelativeUnits<7>;
+		case 8: return convertToRelativeUnits<8>;
+		default: return convertToRelativeUnits<0>;
+	}
+}
+
+void calculateRange(CandlePattern& pattern)
+{
+	pattern.low = std::numeric_limits<double>::max();
+	pattern.high = std::numeric_limits<double>::lowest();
+	for(const auto& el : pattern.elements)
+	{
+		pattern.low = std::min(pattern.low, el.low);
+		pattern.high = std::max(pattern.high, el.high);
+	}
+}
+
+std::string calculateSignature(const Quotes::Ptr& q, size_t pos, int patternLength)
+{
+	std::string signature;
+
+	std::vector<SignatureElement> els;
+	els.reserve(4 * patternLength);
+	for(int i = 0; i < patternLength; i++)
+	{
+		els.emplace_back(q->at(pos + i).open, 'O', i);
+		els.emplace_back(q->at(pos + i).high, 'H', i);
+		els.emplace_back(q->at(pos + i).low, 'L', i);
+		els.emplace_back(q->at(pos + i).close, 'C', i);
+	}
+
+	std::sort(els.begin(), els.end(), [](const SignatureElement& e1, const SignatureElement& e2)
+			{
+				if(e1.price != e2.price)
+					return e1.price < e2.price;
+				else
+					return e1.sign < e2.sign;
+			});
+
+
+	for(const auto& se : els)
+	{
+		signature += se.sign;
+	}
+
+	return signature;
+}
+
+PatternStore::PatternStore(int patternLength) : m_patternLength(patternLength),
+	m_normalize(selectNormalizeKernel(patternLength)),
+	m_signatures(true)
+{
+	m_offsets.push_back(0);
+}
+
+PatternStore::PatternStore(const std::vector<Quotes::Ptr>& quotes, int patternLength) : PatternStore(patternLength)
+{
+	for(const auto& q : quotes)
+	{
+		append(q);
+	}
+}
+
+PatternStore::PatternStore(const std::vector<Quotes::Ptr>& quotes, int patternLength, bool signatures) :
+	PatternStore(patternLength)
+{
+	m_signatures = signatures;
+	for(const auto& q : quotes)
+	{
+		append(q);
+	}
+}
+
+void PatternStore::append(const Quotes::Ptr& q)
+{
+	if(!m_quantized.empty())
+		throw std::runtime_error("Can't append quotes to pattern store after quantization");
+
+	{
+		PROFILE_SCOPE("store.normalization");
+		if(q->length() > (size_t)m_patternLength)
+		{
+			for(size_t pos = 0; pos < q->length() - m_patternLength; pos++)
+			{
+				m_patterns.push_back(m_normalize(*q, pos, m_patternLength));
+				const auto& p = m_patterns.back();
+				m_lastCloses.push_back(p.elements.back().close);
+				m_rangeLows.push_back(p.low);
+				m_rangeHighs.push_back(p.high);
+			}
+		}
+		m_quotes.push_back(q);
+		m_offsets.push_back(m_patterns.size());
+	}
+	if(m_signatures)
+		calculateSignatures(m_quotes.size() - 1);
+}
+
+void PatternStore::calculateSignatures(size_t ticker)
+{
+	PROFILE_SCOPE("store.signatures");
+	for(size_t pos = 0; pos < windows(ticker); pos++)
+	{
+		m_patterns[offset(ticker) + pos].signature = calculateSignature(m_quotes[ticker], pos, m_patternLength);
+	}
+}
+
+PatternStore::~PatternStore()
+{
+}
+
+void PatternStore::quantize(const CandlePattern& pattern, int16_t* row)
+{
+	bool exact = true;
+	auto toFixed = [&exact](double value) {
+		double q = std::round((value - 1) * QuantizationScale);
+		if(std::fabs(q) > std::numeric_limits<int16_t>::max())
+		{
+			exact = false;
+			return (int16_t)0;
+		}
+		return (int16_t)q;
+	};
+
+	row[1] = toFixed(pattern.low);
+	row[2] = toFixed(pattern.high);
+	int16_t* p = row + 3;
+	for(const auto& el : pattern.elements)
+	{
+		*p++ = toFixed(el.close);
+		*p++ = toFixed(el.high);
+		*p++ = toFixed(el.low);
+		*p++ = toFixed(el.open);
+	}
+	row[0] = exact;
+}
+
+void PatternStore::buildQuantized()
+{
+	std::call_once(m_quantizedFlag, [this]() {
+			PROFILE_SCOPE("store.quantization");
+			int stride = quantizedStride(m_patternLength);
+			m_quantized.resize(m_patterns.size() * stride);
+			for(size_t id = 0; id < m_patterns.size(); id++)
+				quantize(m_patterns[id], &m_quantized[id * stride]);
+		});
+}
@@ -0,0 +1,111 @@
+#ifndef PATTERNSTORE_H_R4NW8EJC
+#define PATTERNSTORE_H_R4NW8EJC
+
+#include "model/quotes.h"
+#include "model/fitelement.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct CandlePattern
+{
+	int momentumSign;
+	std::vector<FitElement> elements;
+	std::string signature;
+	double low; // Lowest low of elements
+	double high; // Highest high of elements
+};
+
+/*
+ * Sets low and high of the pattern from its elements
+ */
+void calculateRange(CandlePattern& pattern);
+
+/*
+ * Order of candle prices inside the window at pos: labels O, H, L and C
+ * followed by candle index (as "L0C1H1"), sorted by price, ties by label
+ */
+std::string calculateSignature(const Quotes::Ptr& q, size_t pos, int patternLength);
+
+/*
+ * Every window of patternLength candles of given quotes, normalized by the
+ * open price and volume of its first candle. Windows are numbered
+ * consecutively, ticker by ticker. Momentum sign is left zero as it depends
+ * on miner parameters.
+ */
+class PatternStore
+{
+public:
+	typedef std::shared_ptr<PatternStore> Ptr;
+
+	PatternStore(const std::vector<Quotes::Ptr>& quotes, int patternLength);
+	virtual ~PatternStore();
+
+	/*
+	 * Empty store filled ticker by ticker with append(), so that windows of
+	 * loaded tickers are normalized while later ones are still loading
+	 */
+	explicit PatternStore(int patternLength);
+	void append(const Quotes::Ptr& q);
+
+	/*
+	 * Store without signatures, which are left empty, for miners that
+	 * neither fit nor report them
+	 */
+	PatternStore(const std::vector<Quotes::Ptr>& quotes, int patternLength, bool signatures);
+
+	const std::vector<Quotes::Ptr>& quotes() const { return m_quotes; }
+	int patternLength() const { return m_patternLength; }
+
+	size_t size() const { return m_patterns.size(); }
+	size_t offset(size_t ticker) const { return m_offsets[ticker]; }
+	size_t windows(size_t ticker) const { return m_offsets[ticker + 1] - m_offsets[ticker]; }
+
+	const CandlePattern& operator[](size_t id) const { return m_patterns[id]; }
+
+	/*
+	 * Keys of the first fit tests as columns over window ids: close of the
+	 * last candle and window range, so that candidates can be prefiltered
+	 * in a contiguous pass
+	 */
+	const double* lastCloses() const { return m_lastCloses.data(); }
+	const double* rangeLows() const { return m_rangeLows.data(); }
+	const double* rangeHighs() const { return m_rangeHighs.data(); }
+
+	/*
+	 * Compact copy of window prices: int16 fixed-point offsets from the open
+	 * of the first candle, QuantizationScale units per 1.0. A row is
+	 * [exact, low, high] followed by [close, high, low, open] of every
+	 * candle; exact is zero if some price didn't fit into int16.
+	 */
+	static constexpr double QuantizationScale = 32768;
+	static int quantizedStride(int patternLength) { return 3 + 4 * patternLength; }
+	static void quantize(const CandlePattern& pattern, int16_t* row);
+
+	// Builds quantized rows once, safe to call from several miners
+	void buildQuantized();
+	const int16_t* quantized(size_t id) const { return &m_quantized[id * quantizedStride(m_patternLength)]; }
+
+	// Window normalization specialized for pattern lengths 2 to 8
+	typedef CandlePattern (*NormalizeKernel)(Quotes& q, size_t startPos, int patternLength);
+
+private:
+	void calculateSignatures(size_t ticker);
+
+private:
+	std::vector<Quotes::Ptr> m_quotes;
+	int m_patternLength;
+	NormalizeKernel m_normalize;
+	bool m_signatures;
+	std::vector<size_t> m_offsets;
+	std::vector<CandlePattern> m_patterns;
+	std::vector<double> m_lastCloses;
+	std::vector<double> m_rangeLows;
+	std::vector<double> m_rangeHighs;
+	std::once_flag m_quantizedFlag;
+	std::vector<int16_t> m_quantized;
+};
+
+#endif /* end of include guard: PATTERNSTORE_H_R4NW8EJC */
@@ -0,0 +1,161 @@
+
+#include "statistics.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <boost/math/distributions/students_t.hpp>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+static const double alpha[] = { 0.00001, 0.0001, 0.001, 0.01, 0.05, 0.10, 0.25, 0.5, 1 };
+static const size_t AlphaLevels = sizeof(alpha) / sizeof(alpha[0]);
+
+void binomialPValues(const int* count, const int* posReturns, size_t size, double* p)
+{
+	PROFILE_SCOPE("statistics.binomial");
+	for(size_t i = 0; i < size; i++)
+	{
+		double q = std::fabs(posReturns[i] - (double)count[i] / 2) / std::sqrt(count[i]);
+		p[i] = 1 - std::erf(q);
+	}
+}
+
+void meanPValues(const int* count, const double* mean, const double* sigma, size_t size, double* meanP)
+{
+	PROFILE_SCOPE("statistics.mean");
+	if(size == 0)
+		return;
+
+	// Two-sided critical values of every alpha level for each distinct
+	// degrees of freedom, as boost quantiles dominate the cost otherwise
+	std::vector<int> distinct(count, count + size);
+	std::sort(distinct.begin(), distinct.end());
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+	if(distinct.front() < 2)
+		throw std::runtime_error("Mean p-value needs at least two returns");
+	std::vector<double> critical(distinct.size() * AlphaLevels);
+	for(size_t row = 0; row < distinct.size(); row++)
+	{
+		boost::math::students_t dist(distinct[row] - 1);
+		for(size_t a = 0; a < AlphaLevels; a++)
+			critical[row * AlphaLevels + a] = quantile(complement(dist, alpha[a] / 2));
+	}
+
+	for(size_t i = 0; i < size; i++)
+	{
+		size_t row = std::lower_bound(distinct.begin(), distinct.end(), count[i]) - distinct.begin();
+		const double* T = &critical[row * AlphaLevels];
+		double factor = sigma[i] / std::sqrt(count[i]);
+		meanP[i] = 1;
+		for(size_t a = 0; a < AlphaLevels; a++)
+		{
+			if((mean[i] > 0) && (mean[i] - T[a] * factor > 0))
+			{
+				meanP[i] = alpha[a];
+				break;
+			}
+			if((mean[i] < 0) && (mean[i] + T[a] * factor < 0))
+			{
+				meanP[i] = alpha[a];
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Seed of the resample stream of one count (splitmix64 finalizer), so that
+ * streams of different counts are independent
+ */
+static uint64_t streamSeed(uint64_t seed, int count)
+{
+	uint64_t z = seed + 0x9e3779b97f4a7c15ull * ((uint64_t)count + 1);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+std::vector<double> bootstrapMeanPValues(const std::vector<double>& population,
+		const std::vector<int>& counts, const std::vector<double>& means, int resamples, uint64_t seed, int threads)
+{
+	PROFILE_SCOPE("statistics.bootstrap");
+	if(counts.size() != means.size())
+		throw std::runtime_error("Bootstrap: counts and means differ in size");
+	if(population.empty() || (resamples <= 0))
+		throw std::runtime_error("Bootstrap needs non-empty population and positive number of resamples");
+
+	double populationMean = std::accumulate(population.begin(), population.end(), 0.0) / population.size();
+
+	std::vector<int> distinct(counts);
+	std::sort(distinct.begin(), distinct.end());
+	distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+	if(distinct.empty())
+		return std::vector<double>();
+	if(distinct.front() <= 0)
+		throw std::runtime_error("Bootstrap: counts should be positive");
+
+	// Absolute deviations of resampled means from population mean, one row
+	// of resamples per distinct count. Rows are filled in parallel, larger
+	// counts first as they take longest.
+	std::vector<double> deviations(distinct.size() * resamples);
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for(size_t k = next++; k < distinct.size(); k = next++)
+		{
+			size_t row = distinct.size() - 1 - k;
+			int n = distinct[row];
+			// Indices come from raw engine output: std::uniform_int_distribution is
+			// implementation-defined and would tie p-values to the standard library.
+			// Modulo bias is below 2^-40 for any realistic population
+			std::mt19937_64 rng(streamSeed(seed, n));
+			double* deviation = &deviations[row * resamples];
+			for(int b = 0; b < resamples; b++)
+			{
+				double sum = 0;
+				for(int j = 0; j < n; j++)
+					sum += population[rng() % population.size()];
+				deviation[b] = std::fabs(sum / n - populationMean);
+			}
+			std::sort(deviation, deviation + resamples);
+		}
+	};
+
+	threads = std::max(1, std::min(threads, (int)distinct.size()));
+	std::vector<std::thread> pool;
+	for(int t = 1; t < threads; t++)
+		pool.emplace_back(worker);
+	worker();
+	for(auto& t : pool)
+		t.join();
+
+	std::vector<double> result(counts.size());
+	for(size_t i = 0; i < counts.size(); i++)
+	{
+		size_t row = std::lower_bound(distinct.begin(), distinct.end(), counts[i]) - distinct.begin();
+		const double* first = &deviations[row * resamples];
+		double observed = std::fabs(means[i] - populationMean);
+		size_t extreme = first + resamples - std::lower_bound(first, first + resamples, observed);
+		result[i] = (double)(extreme + 1) / (resamples + 1);
+	}
+	return result;
+}
+
+std::vector<double> benjaminiHochberg(const std::vector<double>& p)
+{
+	std::vector<size_t> order(p.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&p](size_t a, size_t b) { return p[a] < p[b]; });
+
+	std::vector<double> q(p.size());
+	double running = 1;
+	for(size_t k = p.size(); k > 0; k--)
+	{
+		size_t i = order[k - 1];
+		running = std::min(running, p[i] * p.size() / k);
+		q[i] = running;
+	}
+	return q;
+}
@@ -0,0 +1,50 @@
+#ifndef STATISTICS_H_W5RB8NQZ
+#define STATISTICS_H_W5RB8NQZ
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Batch significance kernels, run as a post-pass over arrays of all results
+ * after mining. Element i of the outputs only depends on element i of the
+ * inputs, so ranges of results may be processed in parallel.
+ */
+
+/*
+ * Normal approximation of two-sided binomial test of positive returns:
+ * p = 1 - erf(|pos_returns - count / 2| / sqrt(count))
+ */
+void binomialPValues(const int* count, const int* posReturns, size_t size, double* p);
+
+/*
+ * Smallest level of the alpha ladder (0.00001 ... 1) at which Student's t
+ * interval of the mean excludes zero. Quantiles are computed once per
+ * degrees of freedom present in the batch. Counts should be at least 2.
+ */
+void meanPValues(const int* count, const double* mean, const double* sigma, size_t size, double* meanP);
+
+/*
+ * Two-sided bootstrap p-values of pattern mean returns. Null hypothesis is
+ * that returns of a pattern with count n are n random draws (with
+ * replacement) from population, the returns of all windows.
+ *
+ * All patterns are tested in one batch: resampled means are drawn once per
+ * distinct count, from a stream of its own, so cost is resamples * (sum of
+ * distinct counts), whatever the number of patterns. Rows of distinct
+ * counts are split between threads. The same seed gives the same p-values
+ * with any standard library and number of threads.
+ *
+ * p-values can't go below 1 / (resamples + 1), so Benjamini-Hochberg
+ * q-values of m patterns can't go below m / (resamples + 1).
+ */
+std::vector<double> bootstrapMeanPValues(const std::vector<double>& population,
+		const std::vector<int>& counts, const std::vector<double>& means, int resamples, uint64_t seed, int threads);
+
+/*
+ * Benjamini-Hochberg adjusted p-values (q-values), controlling false
+ * discovery rate over the whole family of tests
+ */
+std::vector<double> benjaminiHochberg(const std::vector<double>& p);
+
+#endif /* end of include guard: STATISTICS_H_W5RB8NQZ */
@@ -1,7 +1,39 @@
 
 #include "ttminer.h"
+#include <cmath>
 #include <map>
+#include <stdexcept>
 #include "log.h"
+#include "model/sparsetable.h"
+#include "progress.h"
+#include "statistics.h"
+
+TtMiner::Params TtMiner::parseParams(const Json::Value& root)
+{
+	Params params;
+	params.limit = root.get("sample-percentage", params.limit).asDouble();
+	params.exitAfter = root.get("exit-after", params.exitAfter).asInt();
+	params.byWeekday = root.get("by-weekday", params.byWeekday).asBool();
+	params.sessions.zone = TimeZone::byName(root.get("time-zone", "UTC").asString());
+
+	auto sessions = root["sessions"];
+	if(!sessions.isNull())
+	{
+		params.sessions.sessions.clear();
+		for(const auto& session : sessions)
+		{
+			auto range = session.asString();
+			auto dash = range.find('-');
+			if(dash == std::string::npos)
+				throw std::runtime_error("Session should be HH:MM-HH:MM: " + range);
+			params.sessions.sessions.push_back(SessionSchedule::Session {
+					parseSessionTime(range.substr(0, dash)), parseSessionTime(range.substr(dash + 1)) });
+		}
+		if(params.sessions.sessions.size() > 127)
+			throw std::runtime_error("Too many sessions");
+	}
+	return params;
+}
 
 TtMiner::TtMiner(const TtMiner::Params& params) :
 	m_params(params)
@@ -15,8 +47,28 @@ TtMiner::~TtMiner()
 std::vector<TtMiner::Result> TtMiner::mine(Quotes& q)
 {
 	std::vector<Result> result;
-	int last_percent = 0;
 	std::vector<int> scanned(q.length(), 0);
+
+	// Group key of every bar, -1 outside of sessions
+	q.calculateTimeKeys(m_params.sessions);
+	std::vector<int32_t> keys(q.length());
+	for(size_t pos = 0; pos < q.length(); pos++)
+	{
+		const auto& k = q.timeKeys()[pos];
+		int weekday = m_params.byWeekday ? k.weekday : 0;
+		keys[pos] = k.session < 0 ? -1 : ((k.session * 7 + weekday) << 16) | k.minute;
+	}
+
+	std::vector<double> lows;
+	std::vector<double> highs;
+	for(size_t pos = 0; pos < q.length(); pos++)
+	{
+		lows.push_back(q[pos].low);
+		highs.push_back(q[pos].high);
+	}
+	RangeMinTable lowTable(lows, m_params.exitAfter);
+	RangeMaxTable highTable(highs, m_params.exitAfter);
+	Progress progress("TtMiner", q.length());
 	for(size_t pos = 0; pos < q.length(); pos++)
 	{
 		if(m_params.limit > 0)
@@ -24,17 +76,11 @@ std::vector<TtMiner::Result> TtMiner::mine(Quotes& q)
 			if((double)pos / q.length() * 100 > (size_t)m_params.limit)
 				break;
 		}
+		progress.advance();
 
-		if(scanned[pos])
+		if(scanned[pos] || (keys[pos] < 0))
 			continue;
 
-		int current_percent = (double)pos / q.length() * 1000;
-		if(current_percent != last_percent)
-		{
-			LOG(DEBUG) << (double)current_percent / 10 << "% done";
-			last_percent = current_percent;
-		}
-
 		double mean = 0;
 		int counter = 0;
 		double min_return = 1.0;
@@ -47,17 +93,12 @@ std::vector<TtMiner::Result> TtMiner::mine(Quotes& q)
 
 		for(size_t scanPos = 0; scanPos < q.length() - m_params.exitAfter; scanPos++)
 		{
-			if((q[scanPos].time.sec % 86400) == (q[pos].time.sec % 86400))
+			if(keys[scanPos] == keys[pos])
 			{
 				size_t exitPos = scanPos + m_params.exitAfter - 1;
 				double this_return = (q[exitPos].close - q[scanPos].open) / q[scanPos].open;
-				double this_low = (q[scanPos].low - q[scanPos].open) / q[scanPos].open;
-				double this_high = (q[scanPos].high - q[scanPos].open) / q[scanPos].open;
-				for(int offset = 0; offset < m_params.exitAfter; offset++)
-				{
-					this_low = std::min(this_low, (q[scanPos + offset].low - q[scanPos].open) / q[scanPos].open);
-					this_high = std::max(this_high, (q[scanPos + offset].high - q[scanPos].open) / q[scanPos].open);
-				}
+				double this_low = (lowTable.query(scanPos, exitPos) - q[scanPos].open) / q[scanPos].open;
+				double this_high = (highTable.query(scanPos, exitPos) - q[scanPos].open) / q[scanPos].open;
 
 				if(this_return > max_return)
 					max_return = this_return;
@@ -75,19 +116,20 @@ std::vector<TtMiner::Result> TtMiner::mine(Quotes& q)
 				scanned[scanPos] = 1;
 			}
 		}
+		progress.addMatches(counter);
+		progress.addComparisons(q.length() - m_params.exitAfter);
 		mean /= counter;
 		if(counter > 1)
 		{
-			double sigma = sqrt(counter);
-			double f = fabs(pos_returns - (double)counter / 2) / sigma;
-			double p = (1 - erf(f));
-
 			Result r;
-			r.time = q[pos].time.sec % 86400;
+			const auto& k = q.timeKeys()[pos];
+			r.time = (m_params.sessions.sessions[k.session].start + k.minute) % 1440 * 60;
+			r.session = k.session;
+			r.weekday = m_params.byWeekday ? k.weekday : -1;
 			r.mean = mean;
 			r.count = counter;
 			r.pos_returns = pos_returns;
-			r.p = p;
+			r.p = 1;
 			r.min_return = min_return;
 			r.max_return = max_return;
 			r.min_low = min_low;
@@ -103,6 +145,17 @@ std::vector<TtMiner::Result> TtMiner::mine(Quotes& q)
 			result.push_back(r);
 		}
 	}
+
+	std::vector<int> counts, posReturns;
+	for(const auto& r : result)
+	{
+		counts.push_back(r.count);
+		posReturns.push_back(r.pos_returns);
+	}
+	std::vector<double> p(result.size());
+	binomialPValues(counts.data(), posReturns.data(), result.size(), p.data());
+	for(size_t i = 0; i < result.size(); i++)
+		result[i].p = p[i];
 	return result;
 }
 
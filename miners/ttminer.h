@@ -2,13 +2,16 @@
 #define TTMINER_H_03QH29KG
 
 #include "model/quotes.h"
+#include "json/value.h"
 
 class TtMiner
 {
 public:
 	struct Result
 	{
-		int time;
+		int time; // Seconds after local midnight of session time zone
+		int session;
+		int weekday; // -1 unless byWeekday is set
 		double mean;
 		int count;
 		int pos_returns;
@@ -22,17 +25,33 @@ public:
 		double max_high;
 	};
 
+	/*
+	 * Bars are grouped by minute since session start; bars outside of all
+	 * sessions are skipped. Time keys are calculated by mine() for the
+	 * schedule and stored in quotes.
+	 */
 	struct Params
 	{
 		Params() : limit(-1),
-			exitAfter(1)
+			exitAfter(1),
+			byWeekday(false)
 		{
 		}
 
 		double limit;
 		int exitAfter;
+		SessionSchedule sessions;
+		bool byWeekday; // Separate groups for every day of week
 	};
 
+	/*
+	 * Params from config:
+	 * { "sample-percentage": 50, "exit-after": 3, "time-zone": "Europe/Moscow",
+	 *   "sessions": [ "10:00-18:45", "19:00-23:50" ], "by-weekday": true }
+	 * Without sessions, the whole day of the zone is one session.
+	 */
+	static Params parseParams(const Json::Value& root);
+
 	TtMiner(const Params& params);
 	virtual ~TtMiner();
 
@@ -7,13 +7,12 @@ typedef double price_t;
 
 struct TimePoint
 {
-	TimePoint(time_t s, int n) :
-		sec(s), nsec(n)
+	explicit TimePoint(time_t s) :
+		sec(s)
 	{
 	}
 
 	time_t sec;
-	int nsec;
 };
 
 struct Candle
@@ -1,5 +1,6 @@
 
 #include "quotes.h"
+#include <charconv>
 #include <fstream>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -8,6 +9,7 @@
 
 #ifdef WIN32
 #define timegm _mkgmtime
+#define gmtime_r(t, tm) gmtime_s(tm, t)
 #endif
 
 using namespace boost::algorithm;
@@ -24,7 +26,7 @@ size_t getIndex(const std::vector<T>& v, const T& value)
 	throw std::runtime_error("Unable to find element: " + value);
 }
 
-static TimePoint parseTime(const std::string& date, const std::string& time)
+TimePoint parseTime(const std::string& date, const std::string& time)
 {
 	int year = lexical_cast<int>(date.substr(0, 4));
 	int month = lexical_cast<int>(date.substr(4, 2));
@@ -41,7 +43,7 @@ static TimePoint parseTime(const std::string& date, const std::string& time)
 	tm.tm_min = minute;
 	tm.tm_sec = second;
 
-	return TimePoint(timegm(&tm), 0);
+	return TimePoint(timegm(&tm));
 }
 
 Quotes::Quotes(const std::string& name) : m_name(name)
@@ -58,6 +60,7 @@ void Quotes::loadFromCsv(const std::string& filename)
 	in.open(filename.c_str(), std::ios_base::in);
 	if(!in.good())
 		throw std::runtime_error("Unable to open file: " + filename);
+	m_timeKeys.clear();
 
 	std::string header;
 	std::getline(in, header);
@@ -108,6 +111,55 @@ void Quotes::loadFromCsv(const std::string& filename)
 	}
 }
 
+void Quotes::saveToCsv(const std::string& filename) const
+{
+	std::ofstream out(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+	if(!out.good())
+		throw std::runtime_error("Unable to open file: " + filename);
+
+	int period = 0;
+	if(m_candles.size() > 1)
+		period = (m_candles[1].time.sec - m_candles[0].time.sec) / 60;
+
+	out << "<TICKER>,<PER>,<DATE>,<TIME>,<OPEN>,<HIGH>,<LOW>,<CLOSE>,<VOL>\n";
+	// Numbers of a line always fit in last 128 bytes of the buffer
+	char buf[256];
+	for(const auto& c : m_candles)
+	{
+		struct tm tm;
+		gmtime_r(&c.time.sec, &tm);
+		out << m_name << ',';
+		char* p = buf;
+		p += snprintf(p, sizeof(buf) - 128, "%d,%04d%02d%02d,%02d%02d%02d,", period,
+				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+		for(double price : { c.open, c.high, c.low, c.close })
+		{
+			p = std::to_chars(p, buf + sizeof(buf), price).ptr;
+			*p++ = ',';
+		}
+		p = std::to_chars(p, buf + sizeof(buf), c.volume).ptr;
+		*p++ = '\n';
+		out.write(buf, p - buf);
+	}
+	if(!out.good())
+		throw std::runtime_error("Unable to write file: " + filename);
+}
+
+void Quotes::append(const Candle& candle)
+{
+	m_candles.push_back(candle);
+	m_timeKeys.clear();
+}
+
+void Quotes::calculateTimeKeys(const SessionSchedule& schedule)
+{
+	m_timeKeys.resize(m_candles.size());
+	for(size_t i = 0; i < m_candles.size(); i++)
+	{
+		m_timeKeys[i] = calculateTimeKey(m_candles[i].time.sec, schedule);
+	}
+}
+
 Candle Quotes::operator[](size_t index) const
 {
 	return m_candles[index];
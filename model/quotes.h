@@ -3,9 +3,15 @@
 
 #include <vector>
 #include "candle.h"
+#include "sessions.h"
 #include <string>
 #include <memory>
 
+/*
+ * Time of finam date (YYYYMMDD) and time (HHMMSS) fields, as UTC
+ */
+TimePoint parseTime(const std::string& date, const std::string& time);
+
 class Quotes
 {
 public:
@@ -15,6 +21,16 @@ public:
 	virtual ~Quotes();
 
 	void loadFromCsv(const std::string& filename);
+	void saveToCsv(const std::string& filename) const;
+
+	void append(const Candle& candle);
+
+	/*
+	 * Session-relative time of every candle, computed once and kept until
+	 * quotes change
+	 */
+	void calculateTimeKeys(const SessionSchedule& schedule);
+	const std::vector<TimeKey>& timeKeys() const { return m_timeKeys; }
 	
 	Candle operator[](size_t index) const;
 	Candle at(size_t index) const;
@@ -25,6 +41,7 @@ public:
 	
 private:
 	std::vector<Candle> m_candles;
+	std::vector<TimeKey> m_timeKeys;
 	std::string m_name;
 
 };
@@ -0,0 +1,183 @@
+
+#include "sessions.h"
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+
+static const time_t Forever = std::numeric_limits<time_t>::max();
+static const int MinutesPerDay = 1440;
+
+// Last Sunday of March to last Sunday of October, 01:00 UTC
+static const DstRule EuRule = { 3, 5, 0, 60, 10, 5, 0, 60, true };
+
+// Last Sunday of March 02:00 to last Sunday of October 03:00 daylight time
+static const DstRule RussiaRule = { 3, 5, 0, 120, 10, 5, 0, 120, false };
+
+// First Sunday of April to last Sunday of October, 02:00 local
+static const DstRule Us1987Rule = { 4, 1, 0, 120, 10, 5, 0, 60, false };
+
+// Second Sunday of March to first Sunday of November, 02:00 local
+static const DstRule Us2007Rule = { 3, 2, 0, 120, 11, 1, 0, 60, false };
+
+struct ZoneEntry
+{
+	const char* name;
+	ZoneEra eras[3];
+	int erasCount;
+};
+
+static const ZoneEntry Zones[] = {
+	{ "UTC", { { Forever, 0, nullptr } }, 1 },
+	{ "Europe/London", { { Forever, 0, &EuRule } }, 1 },
+	{ "Europe/Berlin", { { Forever, 60, &EuRule } }, 1 },
+	{ "Europe/Moscow", {
+			{ 1301180400, 180, &RussiaRule }, // 2011-03-27 02:00 MSK, permanent summer time
+			{ 1414274400, 240, nullptr }, // 2014-10-26 02:00 MSK, permanent standard time
+			{ Forever, 180, nullptr } }, 3 },
+	{ "America/New_York", {
+			{ 1167609600, -300, &Us1987Rule },
+			{ Forever, -300, &Us2007Rule } }, 2 },
+	{ "America/Chicago", {
+			{ 1167609600, -360, &Us1987Rule },
+			{ Forever, -360, &Us2007Rule } }, 2 },
+	{ "Asia/Shanghai", { { Forever, 480, nullptr } }, 1 },
+	{ "Asia/Hong_Kong", { { Forever, 480, nullptr } }, 1 },
+	{ "Asia/Tokyo", { { Forever, 540, nullptr } }, 1 },
+};
+
+/*
+ * Days since 1970-01-01 of proleptic Gregorian date and back
+ */
+static int64_t daysFromCivil(int64_t y, int m, int d)
+{
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static int64_t yearFromDays(int64_t z)
+{
+	z += 719468;
+	int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	int64_t doe = z - era * 146097;
+	int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	int64_t mp = (5 * doy + 2) / 153;
+	int m = mp < 10 ? mp + 3 : mp - 9;
+	return yoe + era * 400 + (m <= 2);
+}
+
+static int64_t floorDiv(int64_t a, int64_t b)
+{
+	return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+static int weekdayFromDays(int64_t days)
+{
+	return (int)(((days % 7) + 11) % 7); // 1970-01-01 was Thursday
+}
+
+static int64_t nthWeekday(int64_t year, int month, int week, int weekday)
+{
+	if(week < 5)
+	{
+		int64_t first = daysFromCivil(year, month, 1);
+		return first + (weekday - weekdayFromDays(first) + 7) % 7 + 7 * (week - 1);
+	}
+	int64_t last = daysFromCivil(year + (month == 12), month % 12 + 1, 1) - 1;
+	return last - (weekdayFromDays(last) - weekday + 7) % 7;
+}
+
+TimeZone::TimeZone() : m_name("UTC")
+{
+	m_eras.push_back(Zones[0].eras[0]);
+}
+
+TimeZone TimeZone::byName(const std::string& name)
+{
+	for(const auto& z : Zones)
+	{
+		if(name == z.name)
+		{
+			TimeZone zone;
+			zone.m_name = name;
+			zone.m_eras.assign(z.eras, z.eras + z.erasCount);
+			return zone;
+		}
+	}
+	throw std::runtime_error("Unknown time zone: " + name);
+}
+
+int TimeZone::utcOffset(time_t t) const
+{
+	const ZoneEra* era = &m_eras.back();
+	for(const auto& e : m_eras)
+	{
+		if(t < e.until)
+		{
+			era = &e;
+			break;
+		}
+	}
+
+	int offset = era->offsetMinutes * 60;
+	const DstRule* rule = era->dst;
+	if(!rule)
+		return offset;
+
+	int64_t year = yearFromDays(floorDiv(t + offset, 86400));
+	int shift = rule->atUtc ? 0 : offset;
+	int64_t start = nthWeekday(year, rule->startMonth, rule->startWeek, rule->startWeekday) * 86400 +
+		rule->startMinutes * 60 - shift;
+	int64_t end = nthWeekday(year, rule->endMonth, rule->endWeek, rule->endWeekday) * 86400 +
+		rule->endMinutes * 60 - shift;
+	if((t >= start) && (t < end))
+		offset += 3600;
+	return offset;
+}
+
+SessionSchedule::SessionSchedule()
+{
+	sessions.push_back(Session { 0, MinutesPerDay });
+}
+
+TimeKey calculateTimeKey(time_t t, const SessionSchedule& schedule)
+{
+	int64_t local = (int64_t)t + schedule.zone.utcOffset(t);
+	int64_t days = floorDiv(local, 86400);
+	int minuteOfDay = (int)((local - days * 86400) / 60);
+
+	TimeKey key;
+	key.minute = 0;
+	key.weekday = weekdayFromDays(days);
+	key.session = -1;
+	for(size_t i = 0; i < schedule.sessions.size(); i++)
+	{
+		const auto& s = schedule.sessions[i];
+		int length = (s.end - s.start + MinutesPerDay - 1) % MinutesPerDay + 1;
+		int sinceStart = (minuteOfDay - s.start + MinutesPerDay) % MinutesPerDay;
+		if(sinceStart < length)
+		{
+			key.minute = sinceStart;
+			key.session = i;
+			if(minuteOfDay < s.start)
+				key.weekday = weekdayFromDays(days - 1);
+			break;
+		}
+	}
+	return key;
+}
+
+int parseSessionTime(const std::string& hhmm)
+{
+	int hours = 0;
+	int minutes = 0;
+	char tail = 0;
+	if((sscanf(hhmm.c_str(), "%d:%d%c", &hours, &minutes, &tail) != 2) ||
+			(hours < 0) || (hours > 24) || (minutes < 0) || (minutes >= 60) || (hours * 60 + minutes > MinutesPerDay))
+		throw std::runtime_error("Session time should be HH:MM: " + hhmm);
+	return hours * 60 + minutes;
+}
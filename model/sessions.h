@@ -0,0 +1,100 @@
+
+#ifndef SESSIONS_H_H4CZ9XKM
+#define SESSIONS_H_H4CZ9XKM
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+/*
+ * Daylight saving rule of bundled time zone table. Transitions happen on
+ * the week-th weekday (0 is Sunday) of the month, week 5 being the last
+ * one, at given minutes after midnight of standard local time, or of UTC
+ * if atUtc is set.
+ */
+struct DstRule
+{
+	int startMonth;
+	int startWeek;
+	int startWeekday;
+	int startMinutes;
+	int endMonth;
+	int endWeek;
+	int endWeekday;
+	int endMinutes;
+	bool atUtc;
+};
+
+/*
+ * Offset rules of one zone, valid until given UTC time
+ */
+struct ZoneEra
+{
+	time_t until;
+	int offsetMinutes; // Standard offset from UTC
+	const DstRule* dst; // Null if there's no daylight saving time
+};
+
+/*
+ * Time zone from bundled rule table, no system tz database is used.
+ * Rules cover 1996 onwards, when EU transitions were unified.
+ */
+class TimeZone
+{
+public:
+	TimeZone();
+
+	/*
+	 * Zone by IANA name, e.g. "Europe/Moscow". Throws if the zone is not in
+	 * the bundled table.
+	 */
+	static TimeZone byName(const std::string& name);
+
+	const std::string& name() const { return m_name; }
+
+	// Offset of local time from UTC at UTC time t, in seconds
+	int utcOffset(time_t t) const;
+
+private:
+	std::string m_name;
+	std::vector<ZoneEra> m_eras;
+};
+
+/*
+ * Trading sessions in local time of zone. A session ending at or before its
+ * start crosses midnight and belongs to the day it starts.
+ */
+struct SessionSchedule
+{
+	struct Session
+	{
+		int start; // Minutes after local midnight
+		int end;
+	};
+
+	// Whole UTC day as one session
+	SessionSchedule();
+
+	TimeZone zone;
+	std::vector<Session> sessions;
+};
+
+/*
+ * Session-relative time of a bar
+ */
+struct TimeKey
+{
+	int16_t minute; // Minutes since session start
+	int8_t weekday; // Day of week the session started, 0 is Sunday
+	int8_t session; // Index in schedule, -1 outside of all sessions
+};
+
+TimeKey calculateTimeKey(time_t t, const SessionSchedule& schedule);
+
+/*
+ * Minutes after midnight of "HH:MM" string
+ */
+int parseSessionTime(const std::string& hhmm);
+
+#endif /* end of include guard: SESSIONS_H_H4CZ9XKM */
@@ -0,0 +1,70 @@
+
+#ifndef SPARSETABLE_H_JW3D8TQE
+#define SPARSETABLE_H_JW3D8TQE
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Answers range minimum (or maximum, depending on Compare) queries over a
+ * fixed array in O(1). Only levels needed for ranges up to maxRange elements
+ * are built, so memory is N * log2(maxRange); ranges are at most maxRange
+ * elements long.
+ */
+template <typename T, typename Compare>
+class SparseTable
+{
+public:
+	SparseTable()
+	{
+	}
+
+	SparseTable(const std::vector<T>& values, size_t maxRange)
+	{
+		// Floor of log2 of every range length, so that queries needn't
+		// count leading zeros (no portable builtin for it)
+		m_log2.assign(std::min(maxRange, values.size()) + 1, 0);
+		for(size_t length = 2; length < m_log2.size(); length++)
+			m_log2[length] = m_log2[length / 2] + 1;
+
+		m_levels.push_back(values);
+		for(size_t width = 2; (width <= maxRange) && (width <= values.size()); width *= 2)
+		{
+			const auto& prev = m_levels.back();
+			std::vector<T> level(values.size() - width + 1);
+			for(size_t i = 0; i < level.size(); i++)
+			{
+				level[i] = pick(prev[i], prev[i + width / 2]);
+			}
+			m_levels.push_back(std::move(level));
+		}
+	}
+
+	// Extremum of values[first..last], inclusive
+	T query(size_t first, size_t last) const
+	{
+		assert(first <= last);
+		assert(last - first + 1 < m_log2.size());
+		int k = m_log2[last - first + 1];
+		const auto& level = m_levels[k];
+		return pick(level[first], level[last + 1 - ((size_t)1 << k)]);
+	}
+
+private:
+	static T pick(const T& a, const T& b)
+	{
+		return Compare()(b, a) ? b : a;
+	}
+
+private:
+	std::vector<std::vector<T>> m_levels;
+	std::vector<uint8_t> m_log2;
+};
+
+typedef SparseTable<double, std::less<double>> RangeMinTable;
+typedef SparseTable<double, std::greater<double>> RangeMaxTable;
+
+#endif /* end of include guard: SPARSETABLE_H_JW3D8TQE */
@@ -0,0 +1,157 @@
+
+#include "syntheticquotes.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+static double roundToTick(double price, double tickSize)
+{
+	if(tickSize <= 0)
+		return price;
+	// Division by exact power of ten gives the double nearest to the decimal
+	// price, so it is written to CSV without representation noise
+	double scale = std::pow(10.0, std::max(0.0, std::ceil(-std::log10(tickSize))));
+	double ticks = std::max(1.0, std::round(price / tickSize));
+	return std::round(ticks * tickSize * scale) / scale;
+}
+
+/*
+ * Draws below use the raw engine output: std distributions are
+ * implementation-defined and give different values across standard libraries
+ */
+static double uniform(std::mt19937_64& rng)
+{
+	// 53 random bits, open interval (0, 1)
+	return ((rng() >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static size_t uniform(std::mt19937_64& rng, size_t low, size_t high)
+{
+	// Modulo bias is below 2^-40 for any realistic series length
+	return low + rng() % (high - low + 1);
+}
+
+static double normal(std::mt19937_64& rng)
+{
+	// Box-Muller, the second value is dropped to keep draws stateless
+	double r = std::sqrt(-2 * std::log(uniform(rng)));
+	return r * std::cos(2 * 3.14159265358979323846 * uniform(rng));
+}
+
+static double exponential(std::mt19937_64& rng)
+{
+	return -std::log(uniform(rng));
+}
+
+/*
+ * Random non-overlapping positions for every planted pattern occurrence
+ */
+static std::vector<Plant> placePatterns(const SyntheticParams& params, std::mt19937_64& rng)
+{
+	std::vector<Plant> result;
+	std::vector<uint8_t> used(params.bars, 0);
+	for(size_t i = 0; i < params.planted.size(); i++)
+	{
+		const auto& p = params.planted[i];
+		if(p.candles.empty() || (p.exitAfter <= 0))
+			throw std::runtime_error("Planted pattern should have candles and positive exit-after");
+		size_t span = p.candles.size() + p.exitAfter;
+		if(span + 1 >= params.bars)
+			throw std::runtime_error("Planted pattern is longer than generated quotes");
+
+		int placed = 0;
+		for(int attempt = 0; (placed < p.count) && (attempt < p.count * 100); attempt++)
+		{
+			size_t pos = uniform(rng, 1, params.bars - span);
+			if(std::any_of(used.begin() + pos, used.begin() + pos + span, [](uint8_t u) { return u != 0; }))
+				continue;
+			std::fill(used.begin() + pos, used.begin() + pos + span, 1);
+			result.push_back(Plant { pos, i });
+			placed++;
+		}
+		if(placed < p.count)
+			throw std::runtime_error("Unable to place " + std::to_string(p.count) + " patterns in " + params.ticker);
+	}
+	std::sort(result.begin(), result.end(), [](const Plant& a, const Plant& b) { return a.pos < b.pos; });
+	return result;
+}
+
+Quotes::Ptr generateQuotes(const SyntheticParams& params, std::vector<Plant>* plants)
+{
+	auto q = std::make_shared<Quotes>(params.ticker);
+	std::mt19937_64 rng(params.seed);
+
+	auto placed = placePatterns(params, rng);
+	if(plants)
+		*plants = placed;
+
+	double omega = params.volatility * params.volatility * (1 - params.garchAlpha - params.garchBeta);
+	if((params.volatilityModel == SyntheticParams::Garch) && (omega <= 0))
+		throw std::runtime_error("GARCH alpha + beta should be less than 1");
+
+	double variance = params.volatility * params.volatility;
+	double logVolume = 0;
+	auto nextVolume = [&](double ret) {
+		logVolume = params.volumePersistence * logVolume + params.volumeVolatility * normal(rng);
+		double shock = params.volatility > 0 ? params.volumeReturnSensitivity * std::fabs(ret) / params.volatility : 0;
+		return (unsigned long)std::max(1.0, std::round(params.meanVolume * std::exp(logVolume + shock)));
+	};
+	auto timeAt = [&](size_t i) {
+		time_t t = params.startTime + (time_t)i * params.period;
+		if(params.sessionBars > 0)
+			t += (time_t)(i / params.sessionBars) * params.sessionGap;
+		return TimePoint(t);
+	};
+
+	double price = roundToTick(params.startPrice, params.tickSize);
+	size_t i = 0;
+	// Bar of the volatility and volume process; drift is added to its log return
+	auto appendBar = [&](double open, double drift) {
+		double sigma = std::sqrt(variance);
+		double shock = sigma * normal(rng);
+		double ret = drift + shock;
+		double close = roundToTick(open * std::exp(ret), params.tickSize);
+		double high = roundToTick(std::max(open, close) * (1 + exponential(rng) * sigma / 2), params.tickSize);
+		double low = roundToTick(std::min(open, close) * (1 - exponential(rng) * sigma / 2), params.tickSize);
+		q->append(Candle(open, high, low, close, nextVolume(ret), timeAt(i++)));
+		price = close;
+
+		if(params.volatilityModel == SyntheticParams::Garch)
+			variance = omega + params.garchAlpha * shock * shock + params.garchBeta * variance;
+	};
+
+	auto nextPlant = placed.begin();
+	while(i < params.bars)
+	{
+		if((nextPlant != placed.end()) && (nextPlant->pos == i))
+		{
+			// Planted bars ignore session gaps so that their returns stay exact
+			const auto& p = params.planted[nextPlant->pattern];
+			double base = price;
+			for(const auto& c : p.candles)
+			{
+				double open = roundToTick(base * c.open, params.tickSize);
+				double close = roundToTick(base * c.close, params.tickSize);
+				double high = std::max(roundToTick(base * c.high, params.tickSize), std::max(open, close));
+				double low = std::min(roundToTick(base * c.low, params.tickSize), std::min(open, close));
+				q->append(Candle(open, high, low, close, nextVolume(std::log(close / open)), timeAt(i++)));
+				price = close;
+			}
+
+			// Forward bars are ordinary random bars, each drifting by an equal
+			// share of the log distance left to the target
+			double target = price * (1 + p.forwardReturn);
+			for(int k = 0; k < p.exitAfter; k++)
+				appendBar(price, std::log(target / price) / (p.exitAfter - k));
+			nextPlant++;
+			continue;
+		}
+
+		double open = price;
+		if((params.sessionBars > 0) && (i > 0) && (i % params.sessionBars == 0) && (params.gapVolatility > 0))
+			open = roundToTick(open * std::exp(params.gapVolatility * normal(rng)), params.tickSize);
+		appendBar(open, 0);
+	}
+	return q;
+}
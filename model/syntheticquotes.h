@@ -0,0 +1,95 @@
+
+#ifndef SYNTHETICQUOTES_H_P2VHC5TW
+#define SYNTHETICQUOTES_H_P2VHC5TW
+
+#include "quotes.h"
+#include <cstdint>
+
+/*
+ * Candle sequence inserted into generated quotes, followed by exitAfter
+ * random bars drifting toward forwardReturn. Prices are relative to the
+ * open of the first candle, the same units CandleMiner compares windows in.
+ */
+struct PlantedPattern
+{
+	PlantedPattern() : count(0), exitAfter(1), forwardReturn(0)
+	{
+	}
+
+	std::vector<Candle> candles;
+	int count; // Occurrences per ticker
+	int exitAfter;
+	double forwardReturn; // Expected return from the open after the pattern to the close exitAfter bars later
+};
+
+/*
+ * Position of a planted pattern in generated quotes
+ */
+struct Plant
+{
+	size_t pos;
+	size_t pattern;
+};
+
+/*
+ * Reproducible OHLCV series for benchmarks and load tests. Same parameters
+ * and seed give the same quotes with any standard library, up to rounding
+ * differences of its math functions.
+ */
+struct SyntheticParams
+{
+	enum VolatilityModel { RandomWalk, Garch };
+
+	SyntheticParams() : bars(10000),
+		seed(1),
+		startPrice(100),
+		tickSize(0.01),
+		startTime(1420070400), // 2015-01-01 00:00:00 UTC
+		period(60),
+		volatilityModel(RandomWalk),
+		volatility(0.002),
+		garchAlpha(0.05),
+		garchBeta(0.9),
+		meanVolume(1000),
+		volumePersistence(0.9),
+		volumeVolatility(0.3),
+		volumeReturnSensitivity(0.5),
+		sessionBars(0),
+		sessionGap(0),
+		gapVolatility(0)
+	{
+	}
+
+	std::string ticker;
+	size_t bars;
+	uint64_t seed;
+	double startPrice;
+	double tickSize;
+	time_t startTime;
+	int period; // Seconds per bar
+
+	VolatilityModel volatilityModel;
+	double volatility; // Standard deviation of log return per bar, unconditional for GARCH
+	double garchAlpha;
+	double garchBeta;
+
+	// Log volume is AR(1) around log(meanVolume), raised on large moves
+	double meanVolume;
+	double volumePersistence;
+	double volumeVolatility;
+	double volumeReturnSensitivity; // Log volume added per standard deviation of return
+
+	size_t sessionBars; // Bars per session, zero for continuous trading
+	int sessionGap; // Seconds between sessions
+	double gapVolatility; // Standard deviation of log price gap between sessions
+
+	std::vector<PlantedPattern> planted;
+};
+
+/*
+ * Generates quotes for params. Positions of planted patterns, in order, are
+ * stored to plants if given.
+ */
+Quotes::Ptr generateQuotes(const SyntheticParams& params, std::vector<Plant>* plants = nullptr);
+
+#endif /* end of include guard: SYNTHETICQUOTES_H_P2VHC5TW */
@@ -0,0 +1,28 @@
+#include "pipeline.h"
+
+Stage::Stage(const std::function<void()>& body)
+{
+	m_thread = std::thread([this, body]() {
+			try
+			{
+				body();
+			}
+			catch(...)
+			{
+				m_error = std::current_exception();
+			}
+		});
+}
+
+Stage::~Stage()
+{
+	if(m_thread.joinable())
+		m_thread.join();
+}
+
+void Stage::join()
+{
+	m_thread.join();
+	if(m_error)
+		std::rethrow_exception(m_error);
+}
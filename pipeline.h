@@ -0,0 +1,86 @@
+
+#ifndef PIPELINE_H_Q3LV8DNE
+#define PIPELINE_H_Q3LV8DNE
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*
+ * Queue between two pipeline stages. push() blocks while capacity items
+ * are waiting, so a fast producer can't run ahead of its consumer. After
+ * close() pop() drains remaining items and then returns false, push()
+ * drops items and returns false.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : m_capacity(capacity), m_closed(false)
+	{
+	}
+
+	bool push(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this]() { return m_closed || (m_items.size() < m_capacity); });
+		if(m_closed)
+			return false;
+		m_items.push_back(std::move(value));
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	bool pop(T& value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+		if(m_items.empty())
+			return false;
+		value = std::move(m_items.front());
+		m_items.pop_front();
+		m_notFull.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+private:
+	size_t m_capacity;
+	bool m_closed;
+	std::deque<T> m_items;
+	std::mutex m_mutex;
+	std::condition_variable m_notEmpty;
+	std::condition_variable m_notFull;
+};
+
+/*
+ * Pipeline stage running on its own thread. join() waits for the stage and
+ * rethrows exception escaped from it. Stage should close its output queue
+ * when done, consumer closes the input queue if it fails, so that neither
+ * side waits forever.
+ */
+class Stage
+{
+public:
+	explicit Stage(const std::function<void()>& body);
+	~Stage();
+
+	void join();
+
+private:
+	std::thread m_thread;
+	std::exception_ptr m_error;
+};
+
+#endif /* end of include guard: PIPELINE_H_Q3LV8DNE */
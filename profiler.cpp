@@ -0,0 +1,60 @@
+
+#include "profiler.h"
+#include "json/json.h"
+#include <fstream>
+#include <iomanip>
+
+Profiler& Profiler::instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+Profiler::Entry& Profiler::entry(const std::string& name, bool timed)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto& e = m_entries[name];
+	if(!e)
+		e.reset(new Entry(timed));
+	return *e;
+}
+
+void Profiler::printSummary(std::ostream& out)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	out << std::left << std::setw(32) << "Phase/counter" << std::right << std::setw(16) << "Count" <<
+		std::setw(16) << "Total, ms" << std::setw(16) << "Mean, us" << std::endl;
+	for(const auto& it : m_entries)
+	{
+		uint64_t count = it.second->count;
+		out << std::left << std::setw(32) << it.first << std::right << std::setw(16) << count;
+		if(it.second->timed)
+		{
+			double total = it.second->nanoseconds / 1e6;
+			out << std::setw(16) << std::fixed << std::setprecision(3) << total <<
+				std::setw(16) << (count > 0 ? total * 1000 / count : 0);
+		}
+		out << std::endl;
+	}
+}
+
+void Profiler::writeJson(const std::string& filename)
+{
+	Json::Value root(Json::objectValue);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for(const auto& it : m_entries)
+		{
+			Json::Value e(Json::objectValue);
+			e["count"] = (Json::UInt64)it.second->count;
+			if(it.second->timed)
+				e["total-ns"] = (Json::UInt64)it.second->nanoseconds;
+			root[it.first] = e;
+		}
+	}
+
+	std::ofstream out(filename);
+	if(!out.good())
+		throw std::runtime_error("Unable to open profile output: " + filename);
+	out << root;
+}
@@ -0,0 +1,86 @@
+
+#ifndef PROFILER_H_6FXM2KLD
+#define PROFILER_H_6FXM2KLD
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/*
+ * Scoped timers and event counters for hot paths. Instrumentation macros
+ * expand to nothing unless PATTERN_MINING_PROFILE is defined.
+ */
+class Profiler
+{
+public:
+	struct Entry
+	{
+		Entry(bool t) : count(0), nanoseconds(0), timed(t)
+		{
+		}
+
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> nanoseconds;
+		bool timed;
+	};
+
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(Entry& entry) : m_entry(entry),
+			m_start(std::chrono::steady_clock::now())
+		{
+		}
+
+		~ScopedTimer()
+		{
+			auto elapsed = std::chrono::steady_clock::now() - m_start;
+			m_entry.count.fetch_add(1, std::memory_order_relaxed);
+			m_entry.nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+					std::memory_order_relaxed);
+		}
+
+	private:
+		Entry& m_entry;
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	static Profiler& instance();
+
+	Entry& entry(const std::string& name, bool timed);
+
+	void printSummary(std::ostream& out);
+	void writeJson(const std::string& filename);
+
+private:
+	std::mutex m_mutex;
+	std::map<std::string, std::unique_ptr<Entry>> m_entries;
+};
+
+#ifdef PATTERN_MINING_PROFILE
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_SCOPE(name) \
+	static Profiler::Entry& PROFILE_CONCAT(profileEntry, __LINE__) = Profiler::instance().entry(name, true); \
+	Profiler::ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(PROFILE_CONCAT(profileEntry, __LINE__))
+
+#define PROFILE_COUNT(name) \
+	do { \
+		static Profiler::Entry& profileEntry = Profiler::instance().entry(name, false); \
+		profileEntry.count.fetch_add(1, std::memory_order_relaxed); \
+	} while(0)
+
+#else
+
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name) do {} while(0)
+
+#endif
+
+#endif /* end of include guard: PROFILER_H_6FXM2KLD */
@@ -0,0 +1,54 @@
+
+#include "progress.h"
+#include "log.h"
+#include <cstdio>
+
+Progress::Progress(const std::string& name, uint64_t total, int intervalSeconds) : m_name(name),
+	m_total(total),
+	m_interval(intervalSeconds),
+	m_start(std::chrono::steady_clock::now()),
+	m_done(0),
+	m_matches(0),
+	m_comparisons(0),
+	m_stop(false)
+{
+	m_thread = std::thread(&Progress::run, this);
+}
+
+Progress::~Progress()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_stopped.notify_all();
+	m_thread.join();
+}
+
+void Progress::run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_stopped.wait_for(lock, m_interval, [this]() { return m_stop; }))
+		report();
+}
+
+void Progress::report()
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+	uint64_t done = m_done.load(std::memory_order_relaxed);
+	double rate = done / seconds;
+
+	char eta[32] = "unknown";
+	if((rate > 0) && (done <= m_total))
+	{
+		long left = (m_total - done) / rate;
+		snprintf(eta, sizeof(eta), "%ld:%02ld:%02ld", left / 3600, (left / 60) % 60, left % 60);
+	}
+
+	char line[256];
+	snprintf(line, sizeof(line), "%.2f%% done, %.1f/s, ETA %s, %lu matches, %.0f comparisons/s",
+			m_total > 0 ? 100.0 * done / m_total : 0.0, rate, eta,
+			(unsigned long)m_matches.load(std::memory_order_relaxed),
+			m_comparisons.load(std::memory_order_relaxed) / seconds);
+	LOG(INFO) << m_name << ": " << line;
+}
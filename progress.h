@@ -0,0 +1,58 @@
+#ifndef PROGRESS_H_K7TQ2ZMB
+#define PROGRESS_H_K7TQ2ZMB
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+ * Progress of a long running loop. Workers only bump relaxed atomic
+ * counters; a reporter thread logs rate, ETA, matches and comparisons per
+ * second every interval until the object is destroyed.
+ */
+class Progress
+{
+public:
+	Progress(const std::string& name, uint64_t total, int intervalSeconds = 10);
+	~Progress();
+
+	void advance(uint64_t steps = 1)
+	{
+		m_done.fetch_add(steps, std::memory_order_relaxed);
+	}
+
+	void addMatches(uint64_t matches)
+	{
+		m_matches.fetch_add(matches, std::memory_order_relaxed);
+	}
+
+	void addComparisons(uint64_t comparisons)
+	{
+		m_comparisons.fetch_add(comparisons, std::memory_order_relaxed);
+	}
+
+private:
+	void run();
+	void report();
+
+private:
+	std::string m_name;
+	uint64_t m_total;
+	std::chrono::seconds m_interval;
+	std::chrono::steady_clock::time_point m_start;
+
+	std::atomic<uint64_t> m_done;
+	std::atomic<uint64_t> m_matches;
+	std::atomic<uint64_t> m_comparisons;
+
+	std::mutex m_mutex;
+	std::condition_variable m_stopped;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+#endif /* end of include guard: PROGRESS_H_K7TQ2ZMB */
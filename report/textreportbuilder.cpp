@@ -1,24 +1,50 @@
 
 #include "textreportbuilder.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
 
-TextReportBuilder::TextReportBuilder()
+// Largest output of std::to_chars for a double in shortest round-trip form
+static const size_t MaxNumberLength = 32;
+
+TextReportBuilder::TextReportBuilder(size_t bufferSize) : m_out(nullptr),
+	m_buffer(std::max(bufferSize, MaxNumberLength)),
+	m_used(0)
 {
 }
 
 TextReportBuilder::~TextReportBuilder()
 {
+	// Report wasn't finished by end(), so write errors are not reported
+	if(m_out)
+	{
+		try
+		{
+			writeBuffer();
+		}
+		catch(...)
+		{
+		}
+		fclose(m_out);
+	}
 }
 
 void TextReportBuilder::start(const std::string& filename,
 		const TimePoint& start_time, const TimePoint& end_time,
 		const std::list<std::string>& tickers)
 {
-	m_out.open(filename.c_str(), std::ios_base::out);
+	m_out = fopen(filename.c_str(), "wb");
+	if(!m_out)
+		throw std::runtime_error("Unable to open report file: " + filename);
+	m_used = 0;
 }
 
 void TextReportBuilder::begin_element(const std::string& title)
 {
-	m_out << "=== " << title << " ===" << std::endl;
+	write("=== ", 4);
+	write(title);
+	write(" ===\n", 5);
 }
 
 void TextReportBuilder::insert_fit_elements(const std::vector<FitElement>& elements)
@@ -26,15 +52,27 @@ void TextReportBuilder::insert_fit_elements(const std::vector<FitElement>& eleme
 	int index = 0;
 	for(const auto& e : elements)
 	{
-		m_out << "C" << index << ": OHLCV:" << e.open << ":" <<
-			e.high << ":" << e.low << ":" << e.close << ":" << e.volume << std::endl;
+		write('C');
+		write(index);
+		write(": OHLCV:", 8);
+		write(e.open);
+		write(':');
+		write(e.high);
+		write(':');
+		write(e.low);
+		write(':');
+		write(e.close);
+		write(':');
+		write(e.volume);
+		write('\n');
 		index++;
 	}
 }
 
 void TextReportBuilder::insert_text(const std::string& text)
 {
-	m_out << text << std::endl;
+	write(text);
+	write('\n');
 }
 
 void TextReportBuilder::end_element()
@@ -43,6 +81,66 @@ void TextReportBuilder::end_element()
 
 void TextReportBuilder::end()
 {
-	m_out.close();
+	if(!m_out)
+		return;
+	writeBuffer();
+	int rc = fclose(m_out);
+	m_out = nullptr;
+	if(rc != 0)
+		throw std::runtime_error("Unable to write report file");
+}
+
+void TextReportBuilder::write(const char* data, size_t size)
+{
+	if(m_used + size > m_buffer.size())
+	{
+		writeBuffer();
+		if(size > m_buffer.size())
+		{
+			if(fwrite(data, 1, size, m_out) != size)
+				throw std::runtime_error("Unable to write report file");
+			return;
+		}
+	}
+	memcpy(m_buffer.data() + m_used, data, size);
+	m_used += size;
+}
+
+void TextReportBuilder::write(const std::string& str)
+{
+	write(str.data(), str.size());
 }
 
+void TextReportBuilder::write(char c)
+{
+	if(m_used == m_buffer.size())
+		writeBuffer();
+	m_buffer[m_used++] = c;
+}
+
+void TextReportBuilder::write(double value)
+{
+	if(m_used + MaxNumberLength > m_buffer.size())
+		writeBuffer();
+	char* begin = m_buffer.data() + m_used;
+	auto r = std::to_chars(begin, begin + MaxNumberLength, value);
+	m_used += r.ptr - begin;
+}
+
+void TextReportBuilder::write(int value)
+{
+	if(m_used + MaxNumberLength > m_buffer.size())
+		writeBuffer();
+	char* begin = m_buffer.data() + m_used;
+	auto r = std::to_chars(begin, begin + MaxNumberLength, value);
+	m_used += r.ptr - begin;
+}
+
+void TextReportBuilder::writeBuffer()
+{
+	if(m_used == 0)
+		return;
+	if(fwrite(m_buffer.data(), 1, m_used, m_out) != m_used)
+		throw std::runtime_error("Unable to write report file");
+	m_used = 0;
+}
@@ -3,12 +3,12 @@
 #define TEXTREPORTBUILDER_H_KBRPEPTZ
 
 #include "builder.h"
-#include <fstream>
+#include <cstdio>
 
 class TextReportBuilder : public ReportBuilder
 {
 public:
-	TextReportBuilder();
+	TextReportBuilder(size_t bufferSize = DefaultBufferSize);
 	virtual ~TextReportBuilder();
 
 	virtual void start(const std::string& filename,
@@ -22,8 +22,20 @@ public:
 
 	virtual void end();
 
+	static const size_t DefaultBufferSize = 4 * 1024 * 1024;
+
+private:
+	void write(const char* data, size_t size);
+	void write(const std::string& str);
+	void write(char c);
+	void write(double value);
+	void write(int value);
+	void writeBuffer();
+
 private:
-	std::fstream m_out;
+	std::FILE* m_out;
+	std::vector<char> m_buffer;
+	size_t m_used;
 };
 
 #endif /* end of include guard: TEXTREPORTBUILDER_H_KBRPEPTZ */